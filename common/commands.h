@@ -0,0 +1,38 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum command_id {
+#define COMMAND(ID, name, verb, usage, label) CMD_##ID,
+#include "commands.def"
+#undef COMMAND
+    CMD_NR
+};
+
+struct command {
+    const char *verb;
+    const char *usage;
+    const char *label;
+};
+
+static const struct command commands[CMD_NR] = {
+#define COMMAND(ID, name, verb, usage, label) [CMD_##ID] = { verb, usage, label },
+#include "commands.def"
+#undef COMMAND
+};
+
+/* FNV-1a with a seed mixed in, the generator searches for a collision-free one */
+static inline uint32_t command_hash(const char *verb, size_t len, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)verb[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Build-time generator for the server's command lookup. Finds a seed for
+ * command_hash() under which every verb of commands.def lands in its own
+ * slot of a power of 2 table and prints that table as a header, so the
+ * server resolves a verb with one hash and one compare:
+ *
+ *     gen_cmdhash > cmd_hash.h
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+
+#define MAX_SEEDS 100000
+
+static int32_t try_seed(uint32_t seed, uint32_t size, int32_t *slots)
+{
+    for (uint32_t i = 0; i < size; i++) { slots[i] = -1; }
+
+    for (int32_t id = 0; id < CMD_NR; id++) {
+        const char *verb = commands[id].verb;
+        uint32_t slot = command_hash(verb, strlen(verb), seed) & (size - 1);
+
+        if (slots[slot] >= 0) { return -1; }
+        slots[slot] = id;
+    }
+    return 0;
+}
+
+int32_t main()
+{
+    static int32_t slots[1 << 16];
+    static const char *const ids[CMD_NR] = {
+#define COMMAND(ID, name, verb, usage, label) [CMD_##ID] = "CMD_" #ID,
+#include "commands.def"
+#undef COMMAND
+    };
+    uint32_t size = 1, seed = 0;
+
+    /* at most half full keeps the search short */
+    while (size < 2 * CMD_NR) { size <<= 1; }
+
+    for (;;) {
+        for (seed = 0; seed < MAX_SEEDS; seed++) {
+            if (!try_seed(seed, size, slots)) { break; }
+        }
+        if (seed < MAX_SEEDS) { break; }
+        if (size == sizeof(slots) / sizeof(slots[0])) {
+            fprintf(stderr, "No collision-free seed, are two verbs the same?\n");
+            return 1;
+        }
+        size <<= 1;
+    }
+
+    printf("/* generated by gen_cmdhash from commands.def, do not edit */\n");
+    printf("#ifndef CMD_HASH_H\n#define CMD_HASH_H\n\n");
+    printf("#include \"commands.h\"\n\n");
+    printf("#define COMMAND_HASH_SEED %uu\n", seed);
+    printf("#define COMMAND_HASH_SIZE %u\n\n", size);
+    printf("static const int8_t command_slots[COMMAND_HASH_SIZE] = {\n");
+    for (uint32_t i = 0; i < size; i++) {
+        printf("    %s,\n", slots[i] < 0 ? "-1" : ids[slots[i]]);
+    }
+    printf("};\n\n#endif\n");
+    return 0;
+}
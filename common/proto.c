@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "proto.h"
+
+/* CRC-16/CCITT-FALSE a nibble at a time, small enough for any host */
+static const uint16_t crc_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+uint16_t proto_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 4) ^ crc_nibble[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc_nibble[(crc >> 12) ^ (data[i] & 0x0f)];
+    }
+    return crc;
+}
+
+static uint16_t get16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static void put16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = val >> 8;
+}
+
+int32_t proto_frame_size(const uint8_t *buf, size_t len)
+{
+    if (len >= 1 && buf[0] != PROTO_MAGIC0) { return -1; }
+    if (len >= 2 && buf[1] != PROTO_MAGIC1) { return -1; }
+    if (len < PROTO_HEADER_SIZE) { return 0; }
+
+    uint16_t payload = get16(buf + 5);
+    if (payload > PROTO_MAX_PAYLOAD) { return -1; }
+
+    return PROTO_HEADER_SIZE + payload + PROTO_CRC_SIZE;
+}
+
+int32_t proto_encode(uint8_t *buf, size_t size, uint8_t type, uint16_t id,
+                     const void *payload, uint16_t len)
+{
+    size_t frame = PROTO_HEADER_SIZE + len + PROTO_CRC_SIZE;
+
+    if (len > PROTO_MAX_PAYLOAD || frame > size) { return -1; }
+
+    buf[0] = PROTO_MAGIC0;
+    buf[1] = PROTO_MAGIC1;
+    buf[2] = type;
+    put16(buf + 3, id);
+    put16(buf + 5, len);
+    if (len) { memcpy(buf + PROTO_HEADER_SIZE, payload, len); }
+    put16(buf + PROTO_HEADER_SIZE + len, proto_crc16(buf, PROTO_HEADER_SIZE + len));
+
+    return frame;
+}
+
+int32_t proto_decode(const uint8_t *buf, size_t size, struct proto_msg *msg)
+{
+    size_t body = size - PROTO_CRC_SIZE;
+
+    if (get16(buf + body) != proto_crc16(buf, body)) { return -1; }
+
+    msg->type = buf[2];
+    msg->id = get16(buf + 3);
+    msg->len = get16(buf + 5);
+    msg->payload = buf + PROTO_HEADER_SIZE;
+    return 0;
+}
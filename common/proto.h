@@ -0,0 +1,53 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary framing for the serial link, spoken once both ends agreed on it
+ * with the text "Proto <version>" command. Every frame is
+ *
+ *     magic[2] type id[2] len[2] payload[len] crc[2]
+ *
+ * little-endian, the CRC-16/CCITT covering everything before it. The id
+ * is the requester's, replies carry the id of the command they answer.
+ */
+#define PROTO_VERSION 1
+
+#define PROTO_MAGIC0 0xa5
+#define PROTO_MAGIC1 0x5a
+
+#define PROTO_HEADER_SIZE 7
+#define PROTO_CRC_SIZE 2
+#define PROTO_MAX_PAYLOAD 256
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD + PROTO_CRC_SIZE)
+
+enum proto_type {
+    PROTO_COMMAND = 1,      /* command id from commands.def, then its arguments */
+    PROTO_REPLY = 2,        /* reply text without the newline */
+};
+
+struct proto_msg {
+    uint8_t type;
+    uint16_t id;
+    uint16_t len;
+    const uint8_t *payload; /* points into the decoded frame */
+};
+
+uint16_t proto_crc16(const uint8_t *data, size_t len);
+
+/*
+ * Size of the frame starting at buf: 0 while fewer than PROTO_HEADER_SIZE
+ * bytes are there to tell, -1 when buf does not start a frame at all.
+ */
+int32_t proto_frame_size(const uint8_t *buf, size_t len);
+
+/* builds a frame in buf, returns its size or -1 if it does not fit */
+int32_t proto_encode(uint8_t *buf, size_t size, uint8_t type, uint16_t id,
+                     const void *payload, uint16_t len);
+
+/* checks a frame proto_frame_size() measured, -1 on a CRC mismatch */
+int32_t proto_decode(const uint8_t *buf, size_t size, struct proto_msg *msg);
+
+#endif
@@ -0,0 +1,52 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+static const struct {
+    uint32_t baud;
+    speed_t speed;
+} speeds[] = {
+    { 1200, B1200 },     { 2400, B2400 },     { 4800, B4800 },
+    { 9600, B9600 },     { 19200, B19200 },   { 38400, B38400 },
+    { 57600, B57600 },   { 115200, B115200 }, { 230400, B230400 },
+    { 460800, B460800 }, { 921600, B921600 },
+};
+
+speed_t serial_speed(uint32_t baud)
+{
+    for (uint32_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if (speeds[i].baud == baud) { return speeds[i].speed; }
+    }
+    return 0;
+}
+
+int32_t serial_configure(int32_t fd, const struct serial_config *config)
+{
+    struct termios options;
+
+    if (fd < 0) { return -1; }
+    if (tcgetattr(fd, &options) < 0) { return -1; }
+
+    cfmakeraw(&options);
+    options.c_cc[VMIN] = config->vmin;
+    options.c_cc[VTIME] = config->vtime;
+
+    if (cfsetispeed(&options, config->speed) < 0) { return -1; }
+    if (cfsetospeed(&options, config->speed) < 0) { return -1; }
+
+    if (tcsetattr(fd, TCSANOW, &options) < 0) { return -1; }
+    return 0;
+}
+
+int32_t serial_open(const char *path, int32_t flags, const struct serial_config *config)
+{
+    int32_t fd = open(path, flags | O_NOCTTY);
+    if (fd < 0) { return -1; }
+
+    if (serial_configure(fd, config) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,34 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <termios.h>
+
+/*
+ * Terminal setup shared by the server and the GUI. The port is put in
+ * full raw mode, cfmakeraw() style: no echo, no CR/NL translation, no
+ * line buffering, every byte handed over as it arrives. Splitting lines
+ * and frames is left to the programs, which both do it themselves.
+ */
+struct serial_config {
+    speed_t speed;
+    /*
+     * Blocking reads only: return once vmin bytes arrived, or vtime tenths
+     * of a second after the last byte. Non-blocking ports ignore them.
+     */
+    uint8_t vmin;
+    uint8_t vtime;
+};
+
+/* 9600 baud, reads return as soon as there is a byte */
+#define SERIAL_CONFIG_DEFAULT { .speed = B9600, .vmin = 1, .vtime = 0 }
+
+/* B-constant for a baud rate, 0 when termios has none for it */
+speed_t serial_speed(uint32_t baud);
+
+int32_t serial_configure(int32_t fd, const struct serial_config *config);
+
+/* opens and configures the port, returns the fd or -1 */
+int32_t serial_open(const char *path, int32_t flags, const struct serial_config *config);
+
+#endif
@@ -12,5 +12,8 @@ FILENAME=$1;
 pkg-config --cflags gtk4;
 pkg-config --libs gtk4;
 
-cc `pkg-config --cflags gtk4` $FILENAME.c -o $FILENAME `pkg-config --libs gtk4`;
+# shared with the server: serial setup and binary framing of the link
+COMMON=`dirname $0`/../common;
+
+cc `pkg-config --cflags gtk4` $FILENAME.c $COMMON/proto.c $COMMON/serial.c -o $FILENAME `pkg-config --libs gtk4`;
 
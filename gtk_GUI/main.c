@@ -1,13 +1,19 @@
 #include <termios.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
 
 #include <gtk/gtk.h>
 
+#include "../common/commands.h"
+#include "../common/proto.h"
+#include "../common/serial.h"
+
 int32_t SERIAL_ID = -1;
 gboolean CONNECTED = FALSE;
 gboolean TRANSMITTING = FALSE;
-// TODO: add timer that waits for read
+gboolean BINARY = FALSE;       // negotiated with "Proto" at connect
+uint16_t REQUEST_ID = 0;
 
 #define BG_COLOR "#323232"
 #define TEXT_COLOR "#f0f0f0" 
@@ -18,28 +24,17 @@ gboolean TRANSMITTING = FALSE;
 #define ACCENT_COLOR "#ff8800"
 
 #define TIMEOUT 3
+#define PROTO_TIMEOUT_MS 1000
 #define APP_HEIGHT 400
 #define APP_WIDTH 800
 #define POPUP_WIDTH 200
 #define POPUP_HEIGHT 200
 
-int32_t terminal_init(int32_t serial)
-{
-    if (serial < 0) { return -1; }
-    struct termios options;
-
-    if(tcgetattr(serial, &options) < 0) { return -1; }
-
-    cfsetispeed(&options, B9600);
-    cfsetospeed(&options, B9600);
-
-    options.c_iflag &= ~BRKINT;
-    options.c_iflag &= ~IMAXBEL;
-    options.c_lflag &= ~ECHO;
-
-    if (tcsetattr(serial, TCSANOW, &options) < 0) { return -1; }
-    return 0;
-}
+typedef struct {
+  int32_t command;          // index into commands[]
+  char *args;
+  GtkTextBuffer *buffer;
+} CommandData;
 
 static void apply_css(void)
 {
@@ -114,24 +109,125 @@ static void print_data(GtkTextBuffer *buffer, gpointer msg_buffer)
   g_print(msg_buffer);
 }
 
-static void send_command(GtkWidget *widget, gpointer data)
+// Reads one '\n' terminated reply of a text mode server, 0 on timeout
+static int32_t read_line(char *line, size_t size, int32_t timeout_ms)
+{
+  struct pollfd pfd = { .fd = SERIAL_ID, .events = POLLIN };
+  size_t len = 0;
+
+  while (len < size - 1) {
+    if (poll(&pfd, 1, timeout_ms) <= 0) { break; }
+    ssize_t read_size = read(SERIAL_ID, line + len, size - 1 - len);
+    if (read_size <= 0) { break; }
+    len += read_size;
+    if (line[len - 1] == '\n') { break; }
+  }
+  line[len] = '\0';
+  return len;
+}
+
+// Reads frames until the reply to id arrives, 0 on timeout
+static int32_t read_reply_frame(uint16_t id, uint8_t *frame, struct proto_msg *msg)
+{
+  struct pollfd pfd = { .fd = SERIAL_ID, .events = POLLIN };
+  size_t len = 0;
+
+  while (poll(&pfd, 1, TIMEOUT * 1000) > 0) {
+    ssize_t read_size = read(SERIAL_ID, frame + len, PROTO_MAX_FRAME - len);
+    if (read_size <= 0) { return 0; }
+    len += read_size;
+
+    for (;;) {
+      int32_t size = proto_frame_size(frame, len);
+      if (size < 0) {
+        // Not at a frame start, resync on the next byte
+        memmove(frame, frame + 1, --len);
+        continue;
+      }
+      if (size == 0 || (size_t)size > len) { break; }
+
+      if (!proto_decode(frame, size, msg) && msg->type == PROTO_REPLY && msg->id == id) {
+        return size;
+      }
+      memmove(frame, frame + size, len - size);
+      len -= size;
+    }
+  }
+  return 0;
+}
+
+// Asks the server for binary frames, stays with text if it does not answer
+static void proto_negotiate(GtkTextBuffer *buffer)
+{
+  char line[64], msg_buffer[128];
+  int32_t version, max_payload;
+
+  g_snprintf(line, sizeof(line), "%s %d\n", commands[CMD_PROTO].verb, PROTO_VERSION);
+  write(SERIAL_ID, line, strlen(line));
+  tcdrain(SERIAL_ID);
+
+  if (!read_line(line, sizeof(line), PROTO_TIMEOUT_MS)
+      || sscanf(line, "Proto %d %d", &version, &max_payload) != 2) {
+    print_data(buffer, (gpointer)"Server speaks text only, using text commands\n");
+    return;
+  }
+
+  BINARY = TRUE;
+  g_snprintf(msg_buffer, sizeof(msg_buffer),
+             "Using binary protocol version %d, payloads up to %d bytes\n",
+             version, max_payload);
+  print_data(buffer, msg_buffer);
+}
+
+static void send_frame_command(CommandData *cmd_data)
 {
-  typedef struct {
-    const char *command;
-    GtkTextBuffer *buffer;
-  } CommandData;
-  
-  CommandData *cmd_data = (CommandData *)data;
-  const char *command = cmd_data->command;
   GtkTextBuffer *buffer = cmd_data->buffer;
-  
-  GtkRoot *popup = gtk_widget_get_root(widget);
-  gtk_window_destroy(GTK_WINDOW(popup));
+  uint8_t payload[PROTO_MAX_PAYLOAD];
+  uint8_t frame[PROTO_MAX_FRAME];
+  char msg_buffer[PROTO_MAX_PAYLOAD + 64];
+  struct proto_msg msg;
+  size_t args_len = strlen(cmd_data->args);
+  uint16_t id = ++REQUEST_ID;
+  int32_t size;
+
+  if (args_len + 1 > sizeof(payload)) {
+    print_data(buffer, (gpointer)"Arguments too long\n");
+    return;
+  }
+  payload[0] = cmd_data->command;
+  memcpy(payload + 1, cmd_data->args, args_len);
+  size = proto_encode(frame, sizeof(frame), PROTO_COMMAND, id, payload, args_len + 1);
+
+  write(SERIAL_ID, frame, size);
+  tcdrain(SERIAL_ID);
+
+  g_snprintf(msg_buffer, sizeof(msg_buffer), "Sending #%u: %s %s\n", id,
+             commands[cmd_data->command].verb, cmd_data->args);
+  print_data(buffer, msg_buffer);
+
+  if (!read_reply_frame(id, frame, &msg)) {
+    print_data(buffer, (gpointer)"Didn't get response\n");
+    return;
+  }
+  g_snprintf(msg_buffer, sizeof(msg_buffer), "Got response #%u: %.*s\n", msg.id,
+             (int)msg.len, (const char *)msg.payload);
+  print_data(buffer, msg_buffer);
+}
+
+static void send_text_command(CommandData *cmd_data)
+{
+  GtkTextBuffer *buffer = cmd_data->buffer;
+  char command[PROTO_MAX_PAYLOAD + 64];
+
+  g_snprintf(command, sizeof(command), "%s%s%s\n", commands[cmd_data->command].verb,
+             cmd_data->args[0] ? " " : "", cmd_data->args);
 
-  int32_t i, read_size = 0;
   char read_buffer[100];
   char msg_buffer[256];
 
+  // Drop stale input before sending, flushing after it could eat the reply
+  tcflush(SERIAL_ID, TCIFLUSH);
+
   // Send data
   write(SERIAL_ID, command, strlen(command));
   tcdrain(SERIAL_ID);
@@ -139,29 +235,49 @@ static void send_command(GtkWidget *widget, gpointer data)
   g_snprintf(msg_buffer, sizeof(msg_buffer), "Sending: %s", command);
   print_data(buffer, msg_buffer);
   
-  tcflush(SERIAL_ID, TCIOFLUSH);
-  // Read incoming data
-  for(i = 0; i < TIMEOUT; i++) {
-    read_size = read(SERIAL_ID, read_buffer, sizeof(read_buffer) - 1);
-    
-    g_snprintf(msg_buffer, sizeof(msg_buffer), "read size: %d\n", read_size);
+  // The port is raw, a reply may come in pieces
+  if (!read_line(read_buffer, sizeof(read_buffer), TIMEOUT * 1000)) {
+    print_data(buffer, (gpointer)"Didn't get response\n");
+  }
+  else if(!strncmp("Done", read_buffer, strlen("Done"))) {
+    print_data(buffer, (gpointer)"Got positive response\n");
+  }
+  else {
+    // Status and errors answer with a line of their own
+    g_snprintf(msg_buffer, sizeof(msg_buffer), "Got response: %s", read_buffer);
     print_data(buffer, msg_buffer);
+  }
+}
 
-    if (read_size > 1) {
-      read_buffer[read_size] = '\0';
-      if(!strcmp("Done\n\n", read_buffer) || !strcmp("Done", read_buffer)) {
-        print_data(buffer, (gpointer)"Got positive response\n");
-        break;
-      }
-      else if (strcmp("Done\n", read_buffer) && i == (TIMEOUT - 1)) {
-        print_data(buffer, (gpointer)"Didn't get response\n");
-      }
-    }
+static void send_command(GtkWidget *widget, gpointer data)
+{
+  CommandData *cmd_data = (CommandData *)data;
+
+  GtkRoot *popup = gtk_widget_get_root(widget);
+  gtk_window_destroy(GTK_WINDOW(popup));
+
+  if (BINARY) {
+    send_frame_command(cmd_data);
   }
-  
+  else {
+    send_text_command(cmd_data);
+  }
+
+  g_free(cmd_data->args);
   g_free(cmd_data);
 }
 
+// Commands taking arguments read them from an entry
+static void send_entry_command(GtkEntry *entry, gpointer data)
+{
+  CommandData *cmd_data = g_new(CommandData, 1);
+
+  cmd_data->command = GPOINTER_TO_INT(data);
+  cmd_data->args = g_strdup(gtk_editable_get_text(GTK_EDITABLE(entry)));
+  cmd_data->buffer = g_object_get_data(G_OBJECT(entry), "buffer");
+  send_command(GTK_WIDGET(entry), cmd_data);
+}
+
 static void send_data_popup(GtkWidget *widget, gpointer data)
 {
   GtkApplication *app = GTK_APPLICATION(data);
@@ -183,27 +299,32 @@ static void send_data_popup(GtkWidget *widget, gpointer data)
   gtk_widget_set_margin_end(button_box, 10);
   gtk_widget_set_valign(button_box, GTK_ALIGN_CENTER);
   
-  // Temp struct
-  typedef struct {
-    const char *command;
-    GtkTextBuffer *buffer;
-  } CommandData;
-  
-  // Button 1: Turn on
-  CommandData *on_data = g_new(CommandData, 1);
-  on_data->command = "Turn on\n";
-  on_data->buffer = buffer;
-  button = gtk_button_new_with_label("Turn on");
-  g_signal_connect(button, "clicked", G_CALLBACK(send_command), on_data);
-  gtk_box_append(GTK_BOX(button_box), button);
+  // One button or entry per command in common/commands.def
+  for (int32_t i = 0; i < CMD_NR; i++) {
+    if (!commands[i].label[0]) {
+      continue;
+    }
+    if (commands[i].usage[0]) {
+      GtkWidget *entry = gtk_entry_new();
+      char *placeholder = g_strdup_printf("%s %s", commands[i].label, commands[i].usage);
+
+      gtk_entry_set_placeholder_text(GTK_ENTRY(entry), placeholder);
+      g_free(placeholder);
+      g_object_set_data(G_OBJECT(entry), "buffer", buffer);
+      g_signal_connect(entry, "activate", G_CALLBACK(send_entry_command),
+                       GINT_TO_POINTER(i));
+      gtk_box_append(GTK_BOX(button_box), entry);
+      continue;
+    }
 
-  // Button 2: Turn off
-  CommandData *off_data = g_new(CommandData, 1);
-  off_data->command = "Turn off\n";
-  off_data->buffer = buffer;
-  button = gtk_button_new_with_label("Turn off");
-  g_signal_connect(button, "clicked", G_CALLBACK(send_command), off_data);
-  gtk_box_append(GTK_BOX(button_box), button);
+    CommandData *cmd_data = g_new(CommandData, 1);
+    cmd_data->command = i;
+    cmd_data->args = g_strdup("");
+    cmd_data->buffer = buffer;
+    button = gtk_button_new_with_label(commands[i].label);
+    g_signal_connect(button, "clicked", G_CALLBACK(send_command), cmd_data);
+    gtk_box_append(GTK_BOX(button_box), button);
+  }
 
   gtk_window_set_child(GTK_WINDOW(popup), button_box);
   gtk_window_present(GTK_WINDOW(popup));
@@ -215,6 +336,8 @@ static void connect_entry(GtkEntry *entry, gpointer *data)
   const gchar *device_name = gtk_editable_get_text(GTK_EDITABLE(entry));
   char device_path[256] = "/dev/";
   char msg_buffer[385];
+  // Blocking reads, poll() bounds the waits
+  const struct serial_config config = SERIAL_CONFIG_DEFAULT;
   
   strncat(device_path, device_name, sizeof(device_path) - strlen("/dev/") - 1);
   
@@ -226,7 +349,7 @@ static void connect_entry(GtkEntry *entry, gpointer *data)
       print_data(buffer, msg_buffer);
       goto destroy_conn_popup;
     }
-    if (terminal_init(SERIAL_ID)) {
+    if (serial_configure(SERIAL_ID, &config)) {
       print_data(buffer, (gpointer)"ERROR: Failed to setup terminal connection!\n");
       close(SERIAL_ID);
       goto destroy_conn_popup;
@@ -235,6 +358,7 @@ static void connect_entry(GtkEntry *entry, gpointer *data)
       CONNECTED = TRUE;
       g_snprintf(msg_buffer, sizeof(msg_buffer), "Successfully connected to device: %s\n", device_path);
       print_data(buffer, msg_buffer);
+      proto_negotiate(buffer);
     }
     
   destroy_conn_popup:
@@ -274,6 +398,7 @@ static void disconnect_device(GtkWidget *widget, gpointer data)
   if(CONNECTED) {
     close(SERIAL_ID);
     CONNECTED = FALSE;
+    BINARY = FALSE;
     print_data(buffer, "Device successfully disconnected\n");
   }
   else {
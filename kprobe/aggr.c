@@ -0,0 +1,353 @@
+/*
+ * Aggregation mode: count calls, bytes and time spent per (pid, comm,
+ * tty index, probe) in per-CPU hash tables, with no kernel log line per
+ * hit unless log_hits is set as well.
+ * Reading the debugfs file merges the CPUs into a snapshot, writing to it
+ * clears the counters.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/kprobes.h>
+#include<linux/tty.h>
+#include<linux/sched.h>
+#include<linux/jhash.h>
+#include<linux/percpu.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/slab.h>
+#include<linux/sort.h>
+
+#include "kprobe_test.h"
+
+static bool aggr;
+module_param(aggr, bool, 0444);
+MODULE_PARM_DESC(aggr, "Keep per-process/per-tty counters (debugfs aggr)");
+
+struct aggr_key {
+  pid_t pid;
+  int tty;
+  u32 probe;
+  char comm[TASK_COMM_LEN];
+};
+
+struct aggr_entry {
+  struct aggr_key key;
+  u32 hash;                 /* 0 marks a free slot, set last on insert */
+  u64 calls;
+  u64 bytes;
+  u64 lat_ns;
+};
+
+/*
+ * Probe handlers never nest on one CPU (kprobes counts a re-entry as
+ * missed), so each CPU owns its table outright. Readers on other CPUs only
+ * see slightly stale counters. A clear is only requested from outside and
+ * carried out by the owning CPU on its next hit.
+ */
+#define AGGR_BITS  8
+#define AGGR_SLOTS (1 << AGGR_BITS)
+
+struct aggr_table {
+  struct aggr_entry entry[AGGR_SLOTS];
+  int reset;
+  u64 full;
+};
+
+static struct aggr_table __percpu *aggr_tables;
+
+static struct module *aggr_owner;
+
+struct aggr_data {
+  u64 ts;
+  int tty;
+};
+
+static struct aggr_entry *aggr_get(struct aggr_table *t, enum kt_probe_id probe,
+                                   int tty)
+{
+  pid_t pid = current->pid;
+  u32 hash = jhash_3words(pid, tty, probe, 0) | 1;
+  unsigned int idx = hash & (AGGR_SLOTS - 1);
+
+  if (unlikely(t->reset)) {
+    memset(t->entry, 0, sizeof(t->entry));
+    t->full = 0;
+    WRITE_ONCE(t->reset, 0);
+  }
+
+  for (int i = 0; i < AGGR_SLOTS; i++) {
+    struct aggr_entry *e = &t->entry[(idx + i) & (AGGR_SLOTS - 1)];
+
+    if (!e->hash) {
+      e->key.pid = pid;
+      e->key.tty = tty;
+      e->key.probe = probe;
+      get_task_comm(e->key.comm, current);
+      smp_wmb();
+      WRITE_ONCE(e->hash, hash);
+      return e;
+    }
+
+    /* comm is not hashed, an exec under the same pid gets its own row */
+    if (e->hash == hash && e->key.pid == pid && e->key.tty == tty
+        && e->key.probe == probe && !strncmp(e->key.comm, current->comm,
+                                             TASK_COMM_LEN))
+      return e;
+  }
+
+  t->full++;
+  return NULL;
+}
+
+static void aggr_account(enum kt_probe_id probe, struct aggr_data *d, long bytes)
+{
+  struct aggr_entry *e = aggr_get(this_cpu_ptr(aggr_tables), probe, d->tty);
+  u64 now = kt_now();
+
+  if (!e)
+    return;
+
+  e->calls++;
+  if (bytes > 0)
+    e->bytes += bytes;
+  e->lat_ns += now > d->ts ? now - d->ts : 0;
+}
+
+static __always_inline int aggr_entry(struct kretprobe_instance *ri,
+                                      struct tty_struct *tty)
+{
+  struct aggr_data *d = (struct aggr_data *)ri->data;
+
+  d->tty = tty ? tty->index : -1;
+  d->ts = kt_now();
+  return 0;
+}
+
+/* acm_tty_open/write/close all take the tty first */
+static int aggr_tty_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  return aggr_entry(ri, (struct tty_struct *)regs_get_kernel_argument(regs, 0));
+}
+
+/* n_tty_read serves every tty, keep only the target driver's */
+static int aggr_read_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  struct tty_struct *tty = (struct tty_struct *)regs_get_kernel_argument(regs, 0);
+
+  if (!tty || !tty->driver || tty->driver->owner != READ_ONCE(aggr_owner))
+    return 1;
+  return aggr_entry(ri, tty);
+}
+
+static int aggr_open_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  aggr_account(KT_PROBE_OPEN, (struct aggr_data *)ri->data, 0);
+  return 0;
+}
+
+static int aggr_read_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  aggr_account(KT_PROBE_READ, (struct aggr_data *)ri->data,
+               regs_return_value(regs));
+  return 0;
+}
+
+static int aggr_write_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  aggr_account(KT_PROBE_WRITE, (struct aggr_data *)ri->data,
+               regs_return_value(regs));
+  return 0;
+}
+
+static int aggr_close_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  aggr_account(KT_PROBE_CLOSE, (struct aggr_data *)ri->data, 0);
+  return 0;
+}
+
+static struct kretprobe aggr_probes[KT_PROBE_BASE_NR] = {
+  [KT_PROBE_OPEN]  = { .entry_handler = aggr_tty_entry,
+                       .handler = aggr_open_ret  },
+  [KT_PROBE_READ]  = { .entry_handler = aggr_read_entry,
+                       .handler = aggr_read_ret  },
+  [KT_PROBE_WRITE] = { .entry_handler = aggr_tty_entry,
+                       .handler = aggr_write_ret },
+  [KT_PROBE_CLOSE] = { .entry_handler = aggr_tty_entry,
+                       .handler = aggr_close_ret },
+};
+
+static int aggr_armed;
+
+static void aggr_disarm(void)
+{
+  for (int i = KT_PROBE_BASE_NR - 1; i >= 0; i--) {
+    if (aggr_armed & BIT(i))
+      unregister_kretprobe(&aggr_probes[i]);
+  }
+  aggr_armed = 0;
+  WRITE_ONCE(aggr_owner, NULL);
+}
+
+static int aggr_arm(struct module *mod)
+{
+  int retval = 0;
+
+  if (!aggr)
+    return 0;
+
+  WRITE_ONCE(aggr_owner, mod);
+
+  for (int i = 0; i < KT_PROBE_BASE_NR; i++) {
+    struct kretprobe *rp = &aggr_probes[i];
+    kretprobe_handler_t entry = rp->entry_handler, handler = rp->handler;
+
+    memset(rp, 0, sizeof(*rp));
+    rp->entry_handler = entry;
+    rp->handler = handler;
+    rp->data_size = sizeof(struct aggr_data);
+
+    /* the process side of a read is n_tty_read, not the URB callback */
+    if (i == KT_PROBE_READ)
+      rp->kp.symbol_name = "n_tty_read";
+    else
+      rp->kp.addr = kt_probe_addr(i);
+
+    if (!rp->kp.symbol_name && !rp->kp.addr) {
+      retval = -ENOENT;
+      break;
+    }
+
+    retval = register_kretprobe(rp);
+    if (retval < 0) {
+      pr_err("Kretprobe registration for aggr %s failed. Error number: %d",
+             kt_probe_names[i], retval);
+      break;
+    }
+    aggr_armed |= BIT(i);
+  }
+
+  if (retval < 0)
+    aggr_disarm();
+  return retval;
+}
+
+static int aggr_cmp(const void *a, const void *b)
+{
+  const struct aggr_key *ka = a, *kb = b;
+
+  if (ka->pid != kb->pid)
+    return ka->pid < kb->pid ? -1 : 1;
+  if (ka->tty != kb->tty)
+    return ka->tty < kb->tty ? -1 : 1;
+  if (ka->probe != kb->probe)
+    return ka->probe < kb->probe ? -1 : 1;
+  return strncmp(ka->comm, kb->comm, TASK_COMM_LEN);
+}
+
+static int aggr_snapshot_show(struct seq_file *m, void *v)
+{
+  struct aggr_entry *snap;
+  size_t nr = 0, max_nr = (size_t)num_possible_cpus() * AGGR_SLOTS;
+  u64 full = 0;
+  int cpu;
+
+  snap = kvmalloc_array(max_nr, sizeof(*snap), GFP_KERNEL);
+  if (!snap)
+    return -ENOMEM;
+
+  for_each_possible_cpu(cpu) {
+    struct aggr_table *t = per_cpu_ptr(aggr_tables, cpu);
+
+    /* a clear is still pending there, nothing to report */
+    if (READ_ONCE(t->reset))
+      continue;
+
+    for (int i = 0; i < AGGR_SLOTS; i++) {
+      if (!READ_ONCE(t->entry[i].hash))
+        continue;
+      smp_rmb();
+      snap[nr++] = t->entry[i];
+    }
+    full += t->full;
+  }
+
+  sort(snap, nr, sizeof(*snap), aggr_cmp, NULL);
+
+  seq_printf(m, "%-8s %-16s %4s %-6s %12s %14s %16s %12s\n", "pid", "comm",
+             "tty", "probe", "calls", "bytes", "total_ns", "avg_ns");
+
+  for (size_t i = 0; i < nr; ) {
+    struct aggr_entry sum = snap[i];
+
+    /* the same key shows up once per CPU the task ran on */
+    while (++i < nr && !aggr_cmp(&snap[i].key, &sum.key)) {
+      sum.calls += snap[i].calls;
+      sum.bytes += snap[i].bytes;
+      sum.lat_ns += snap[i].lat_ns;
+    }
+
+    seq_printf(m, "%-8d %-16.16s %4d %-6s %12llu %14llu %16llu %12llu\n",
+               sum.key.pid, sum.key.comm, sum.key.tty,
+               kt_probe_names[sum.key.probe], sum.calls, sum.bytes, sum.lat_ns,
+               sum.calls ? div64_u64(sum.lat_ns, sum.calls) : 0);
+  }
+
+  if (full)
+    seq_printf(m, "table full, %llu hits not counted\n", full);
+
+  kvfree(snap);
+  return 0;
+}
+
+static int aggr_snapshot_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, aggr_snapshot_show, inode->i_private);
+}
+
+static ssize_t aggr_snapshot_write(struct file *file, const char __user *buf,
+                                   size_t len, loff_t *ppos)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+    WRITE_ONCE(per_cpu_ptr(aggr_tables, cpu)->reset, 1);
+
+  return len;
+}
+
+static const struct file_operations aggr_snapshot_fops = {
+  .owner = THIS_MODULE,
+  .open = aggr_snapshot_open,
+  .read = seq_read,
+  .write = aggr_snapshot_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+static int aggr_init(struct dentry *dir)
+{
+  if (!aggr)
+    return 0;
+
+  aggr_tables = alloc_percpu(struct aggr_table);
+  if (!aggr_tables)
+    return -ENOMEM;
+
+  debugfs_create_file("aggr", 0644, dir, NULL, &aggr_snapshot_fops);
+  return 0;
+}
+
+static void aggr_exit(void)
+{
+  free_percpu(aggr_tables);
+}
+
+const struct kt_feature aggr_feature = {
+  .name = "aggr",
+  .init = aggr_init,
+  .exit = aggr_exit,
+  .arm = aggr_arm,
+  .disarm = aggr_disarm,
+};
@@ -0,0 +1,344 @@
+/*
+ * Probe overhead benchmark. kt_bench_target() is a trivial noinline
+ * function called in a tight loop; each run attaches one kind of handler
+ * to it and times the loop, so the difference to the unprobed run is the
+ * cost per hit. Handlers mirror what kprobe_test does: a bare pr_info, a
+ * kt_event pushed into a ring the same way stream.c does it, on entry
+ * (kprobe, fprobe) or on return (kretprobe). With sample > 1 the handler
+ * still fires on every hit but only does its work 1 in N times.
+ *
+ * Driven through debugfs kt_bench/run:
+ *   echo "<mode> <loops> <sample>" > run    runs synchronously
+ *   cat run                                 last result
+ * run_bench in this directory does the sweep and prints the table.
+ */
+
+#include<linux/init.h>
+#include<linux/module.h>
+#include<linux/kernel.h>
+#include<linux/kprobes.h>
+#include<linux/fprobe.h>
+#include<linux/debugfs.h>
+#include<linux/mutex.h>
+#include<linux/sched.h>
+#include<linux/vmalloc.h>
+#include<linux/uaccess.h>
+#include<linux/version.h>
+
+#include "../kt_event.h"
+#include "../kt_ring.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+#define BENCH_RING_EVENTS 4096
+/* loop iterations per preemption-off chunk, below the ring size */
+#define BENCH_CHUNK 1024
+#define BENCH_MAX_LOOPS 100000000ULL
+
+enum bench_mode {
+  BENCH_NONE,
+  BENCH_KPROBE_EMPTY,
+  BENCH_KPROBE_PRINTK,
+  BENCH_KPROBE_RING,
+  BENCH_KRETPROBE_RING,
+  BENCH_FPROBE_RING,
+  BENCH_MODE_NR,
+};
+
+static const char *const bench_mode_names[BENCH_MODE_NR] = {
+  [BENCH_NONE] = "none",
+  [BENCH_KPROBE_EMPTY] = "kprobe_empty",
+  [BENCH_KPROBE_PRINTK] = "kprobe_printk",
+  [BENCH_KPROBE_RING] = "kprobe_ring",
+  [BENCH_KRETPROBE_RING] = "kretprobe_ring",
+  [BENCH_FPROBE_RING] = "fprobe_ring",
+};
+
+struct bench_result {
+  enum bench_mode mode;
+  u64 loops;
+  u32 sample;
+  u64 ns;
+  u64 hits;
+  u64 recorded;
+  u64 missed;
+};
+
+static DEFINE_MUTEX(bench_lock);
+static struct bench_result bench_last;
+static struct dentry *bench_debugfs;
+
+/* only the benchmark loop calls the target, with preemption off */
+static u32 bench_sample, bench_countdown;
+static u64 bench_hits, bench_recorded;
+
+static struct kt_ring_header *bench_hdr;
+static struct kt_event *bench_ring;
+static u64 bench_head;
+
+/* no clone, the loop has to call the copy the probes are attached to */
+static noinline __noclone u64 kt_bench_target(u64 x)
+{
+  /* keep the call and its argument opaque to the optimizer */
+  asm volatile("" : "+r"(x));
+  return x + 1;
+}
+
+/* true when this hit is one the handler should act on */
+static __always_inline bool bench_take(void)
+{
+  bench_hits++;
+  if (--bench_countdown)
+    return false;
+  bench_countdown = bench_sample;
+  return true;
+}
+
+static __always_inline void bench_record(unsigned long ip, u8 type)
+{
+  struct kt_event ev = {
+    .ts = ktime_get_mono_fast_ns(),
+    .val = ip,
+    .pid = current->tgid,
+    .tty = -1,
+    .type = type,
+    .cpu = smp_processor_id(),
+  };
+
+  memcpy(ev.comm, current->comm, sizeof(ev.comm));
+  if (kt_ring_push(bench_hdr, bench_ring, BENCH_RING_EVENTS - 1,
+                   &bench_head, &ev) >= 0)
+    bench_recorded++;
+}
+
+static int bench_empty_pre(struct kprobe *kp, struct pt_regs *regs)
+{
+  bench_take();
+  return 0;
+}
+
+static int bench_printk_pre(struct kprobe *kp, struct pt_regs *regs)
+{
+  if (bench_take()) {
+    pr_info("kt_bench: target hit");
+    bench_recorded++;
+  }
+  return 0;
+}
+
+static int bench_ring_pre(struct kprobe *kp, struct pt_regs *regs)
+{
+  if (bench_take())
+    bench_record((unsigned long)kp->addr, KT_EV_ENTRY);
+  return 0;
+}
+
+static int bench_ring_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  if (bench_take())
+    bench_record(regs_return_value(regs), KT_EV_RETURN);
+  return 0;
+}
+
+static struct kprobe bench_kp;
+static struct kretprobe bench_krp;
+
+#ifdef CONFIG_FPROBE
+/* the entry handler signature has changed with most releases */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+static int bench_fprobe_entry(struct fprobe *fp, unsigned long ip,
+                              unsigned long ret_ip, struct ftrace_regs *regs,
+                              void *data)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+static int bench_fprobe_entry(struct fprobe *fp, unsigned long ip,
+                              unsigned long ret_ip, struct pt_regs *regs,
+                              void *data)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static int bench_fprobe_entry(struct fprobe *fp, unsigned long ip,
+                              struct pt_regs *regs, void *data)
+#else
+static void bench_fprobe_entry(struct fprobe *fp, unsigned long ip,
+                               struct pt_regs *regs)
+#endif
+{
+  if (bench_take())
+    bench_record(ip, KT_EV_ENTRY);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+  return 0;
+#endif
+}
+
+static struct fprobe bench_fp;
+#endif
+
+static int bench_attach(enum bench_mode mode)
+{
+  switch (mode) {
+  case BENCH_NONE:
+    return 0;
+  case BENCH_KPROBE_EMPTY:
+  case BENCH_KPROBE_PRINTK:
+  case BENCH_KPROBE_RING:
+    memset(&bench_kp, 0, sizeof(bench_kp));
+    bench_kp.addr = (kprobe_opcode_t *)kt_bench_target;
+    bench_kp.pre_handler = mode == BENCH_KPROBE_EMPTY ? bench_empty_pre :
+                           mode == BENCH_KPROBE_PRINTK ? bench_printk_pre :
+                           bench_ring_pre;
+    return register_kprobe(&bench_kp);
+  case BENCH_KRETPROBE_RING:
+    memset(&bench_krp, 0, sizeof(bench_krp));
+    bench_krp.kp.addr = (kprobe_opcode_t *)kt_bench_target;
+    bench_krp.handler = bench_ring_ret;
+    bench_krp.maxactive = 4;
+    return register_kretprobe(&bench_krp);
+  case BENCH_FPROBE_RING:
+#ifdef CONFIG_FPROBE
+    memset(&bench_fp, 0, sizeof(bench_fp));
+    bench_fp.entry_handler = bench_fprobe_entry;
+    return register_fprobe(&bench_fp, "kt_bench_target", NULL);
+#else
+    return -EOPNOTSUPP;
+#endif
+  default:
+    return -EINVAL;
+  }
+}
+
+static u64 bench_detach(enum bench_mode mode)
+{
+  switch (mode) {
+  case BENCH_KPROBE_EMPTY:
+  case BENCH_KPROBE_PRINTK:
+  case BENCH_KPROBE_RING:
+    unregister_kprobe(&bench_kp);
+    return bench_kp.nmissed;
+  case BENCH_KRETPROBE_RING:
+    unregister_kretprobe(&bench_krp);
+    return bench_krp.nmissed + bench_krp.kp.nmissed;
+#ifdef CONFIG_FPROBE
+  case BENCH_FPROBE_RING:
+    unregister_fprobe(&bench_fp);
+    return bench_fp.nmissed;
+#endif
+  default:
+    return 0;
+  }
+}
+
+static int bench_run(enum bench_mode mode, u64 loops, u32 sample)
+{
+  u64 start, done, acc = 0;
+  int ret;
+
+  bench_sample = bench_countdown = sample;
+  bench_hits = bench_recorded = 0;
+  bench_head = 0;
+  memset(bench_hdr, 0, sizeof(*bench_hdr));
+
+  ret = bench_attach(mode);
+  if (ret) {
+    pr_err("kt_bench: attaching %s failed. Error number: %d\n",
+           bench_mode_names[mode], ret);
+    return ret;
+  }
+
+  start = ktime_get_ns();
+  for (done = 0; done < loops; ) {
+    u64 n = min_t(u64, loops - done, BENCH_CHUNK);
+
+    /* one CPU feeds the ring, then stands in for the reader */
+    preempt_disable();
+    for (done += n; n; n--)
+      acc = kt_bench_target(acc);
+    smp_store_release(&bench_hdr->tail, bench_head);
+    preempt_enable();
+    cond_resched();
+  }
+
+  bench_last = (struct bench_result) {
+    .mode = mode,
+    .loops = loops,
+    .sample = sample,
+    .ns = ktime_get_ns() - start,
+    .hits = bench_hits,
+    .recorded = bench_recorded,
+  };
+  bench_last.missed = bench_detach(mode);
+
+  /* acc == loops unless the target was optimized away */
+  return acc == loops ? 0 : -EIO;
+}
+
+static ssize_t bench_read(struct file *file, char __user *ubuf, size_t len,
+                          loff_t *ppos)
+{
+  char buf[192];
+  int n;
+
+  mutex_lock(&bench_lock);
+  n = scnprintf(buf, sizeof(buf),
+                "mode=%s loops=%llu sample=%u ns=%llu hits=%llu recorded=%llu missed=%llu\n",
+                bench_mode_names[bench_last.mode], bench_last.loops,
+                bench_last.sample, bench_last.ns, bench_last.hits,
+                bench_last.recorded, bench_last.missed);
+  mutex_unlock(&bench_lock);
+
+  return simple_read_from_buffer(ubuf, len, ppos, buf, n);
+}
+
+static ssize_t bench_write(struct file *file, const char __user *ubuf,
+                           size_t len, loff_t *ppos)
+{
+  char buf[64], name[24];
+  unsigned long long loops;
+  unsigned int sample;
+  int mode, ret;
+
+  if (len >= sizeof(buf))
+    return -EINVAL;
+  if (copy_from_user(buf, ubuf, len))
+    return -EFAULT;
+  buf[len] = '\0';
+
+  if (sscanf(buf, "%23s %llu %u", name, &loops, &sample) != 3
+      || !loops || loops > BENCH_MAX_LOOPS || !sample)
+    return -EINVAL;
+
+  mode = match_string(bench_mode_names, BENCH_MODE_NR, name);
+  if (mode < 0)
+    return mode;
+
+  mutex_lock(&bench_lock);
+  ret = bench_run(mode, loops, sample);
+  mutex_unlock(&bench_lock);
+
+  return ret ? ret : len;
+}
+
+static const struct file_operations bench_fops = {
+  .owner = THIS_MODULE,
+  .read = bench_read,
+  .write = bench_write,
+  .llseek = default_llseek,
+};
+
+static int __init kt_bench_init(void)
+{
+  bench_hdr = vzalloc(PAGE_SIZE + BENCH_RING_EVENTS * sizeof(struct kt_event));
+  if (!bench_hdr)
+    return -ENOMEM;
+  bench_ring = (struct kt_event *)((char *)bench_hdr + PAGE_SIZE);
+
+  bench_debugfs = debugfs_create_dir("kt_bench", NULL);
+  debugfs_create_file("run", 0600, bench_debugfs, NULL, &bench_fops);
+  return 0;
+}
+
+static void __exit kt_bench_exit(void)
+{
+  debugfs_remove_recursive(bench_debugfs);
+  vfree(bench_hdr);
+}
+
+module_init(kt_bench_init);
+module_exit(kt_bench_exit);
@@ -0,0 +1,151 @@
+/*
+ * Drives the kt_bench module: runs every handler mode unsampled and
+ * sampled, repeats each run and keeps the median, then prints the cost
+ * per hit over the unprobed loop and what it does to call throughput.
+ *
+ *   insmod kt_bench.ko && ./run_bench [-l loops] [-p printk_loops]
+ *                                     [-r repeats] [-s sample]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define RUN_FILE "/sys/kernel/debug/kt_bench/run"
+
+static const char *const modes[] = {
+    "none", "kprobe_empty", "kprobe_printk", "kprobe_ring",
+    "kretprobe_ring", "fprobe_ring",
+};
+#define MODE_NR (sizeof(modes) / sizeof(modes[0]))
+
+struct result {
+    unsigned long long ns;
+    unsigned long long hits;
+    unsigned long long recorded;
+    unsigned long long missed;
+};
+
+/* one synchronous run, returns -errno as the module reported it */
+static int run_once(const char *mode, unsigned long long loops, unsigned int sample,
+                    struct result *res)
+{
+    char buf[256];
+    ssize_t n;
+    int fd, ret = 0;
+
+    fd = open(RUN_FILE, O_RDWR);
+    if (fd < 0) { return -errno; }
+
+    n = snprintf(buf, sizeof(buf), "%s %llu %u", mode, loops, sample);
+    if (write(fd, buf, n) != n) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    n = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    if (n <= 0) { return -EIO; }
+    buf[n] = '\0';
+
+    if (sscanf(buf, "mode=%*s loops=%*u sample=%*u ns=%llu hits=%llu recorded=%llu missed=%llu",
+               &res->ns, &res->hits, &res->recorded, &res->missed) != 4) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+    const struct result *ra = a, *rb = b;
+    return ra->ns < rb->ns ? -1 : ra->ns > rb->ns;
+}
+
+/* median of the repeats, so one preempted run does not skew the table */
+static int run_median(const char *mode, unsigned long long loops, unsigned int sample,
+                      int repeats, struct result *res)
+{
+    struct result runs[repeats];
+
+    for (int i = 0; i < repeats; i++) {
+        int ret = run_once(mode, loops, sample, &runs[i]);
+        if (ret) { return ret; }
+    }
+    qsort(runs, repeats, sizeof(runs[0]), cmp_ns);
+    *res = runs[repeats / 2];
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-l loops] [-p printk_loops] [-r repeats] [-s sample]\n"
+            "  -l  target calls per run (default 1000000)\n"
+            "  -p  calls per run for the printk handler (default 20000)\n"
+            "  -r  runs per row, the median is shown (default 5)\n"
+            "  -s  sampled rows act on 1 hit in this many (default 16)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long loops = 1000000, printk_loops = 20000;
+    unsigned int sample = 16;
+    int repeats = 5, opt;
+    double base_ns;
+    struct result base;
+
+    while ((opt = getopt(argc, argv, "l:p:r:s:h")) != -1) {
+        switch (opt) {
+        case 'l': loops = strtoull(optarg, NULL, 0); break;
+        case 'p': printk_loops = strtoull(optarg, NULL, 0); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 's': sample = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!loops || !printk_loops || repeats < 1 || sample < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (run_median("none", loops, 1, repeats, &base)) {
+        perror("Error running the baseline, is kt_bench loaded and debugfs mounted");
+        return 1;
+    }
+    base_ns = (double)base.ns / loops;
+
+    printf("%-15s %6s %10s %10s %10s %10s %9s %10s %8s\n", "mode", "sample",
+           "loops", "ns/call", "ns/hit", "Mcalls/s", "slowdown", "recorded", "missed");
+    printf("%-15s %6u %10llu %10.2f %10s %10.2f %8s%% %10s %8s\n", "none", 1, loops,
+           base_ns, "-", 1e3 / base_ns, "0.0", "-", "-");
+
+    for (size_t m = 1; m < MODE_NR; m++) {
+        unsigned long long n = strcmp(modes[m], "kprobe_printk") ? loops : printk_loops;
+        unsigned int samples[] = { 1, sample };
+
+        for (size_t s = 0; s < 2; s++) {
+            struct result res;
+            double per_call;
+            int ret = run_median(modes[m], n, samples[s], repeats, &res);
+
+            if (ret) {
+                printf("%-15s %6u %10s %s\n", modes[m], samples[s], "n/a", strerror(-ret));
+                break;
+            }
+            per_call = (double)res.ns / n;
+            printf("%-15s %6u %10llu %10.2f %10.2f %10.2f %8.1f%% %10llu %8llu\n",
+                   modes[m], samples[s], n, per_call, per_call - base_ns,
+                   1e3 / per_call, 100.0 * (per_call - base_ns) / per_call,
+                   res.recorded, res.missed);
+        }
+    }
+    return 0;
+}
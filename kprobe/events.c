@@ -0,0 +1,179 @@
+/*
+ * Event producer: entry/return probes on the target's open, read callback,
+ * write and close that build a struct kt_event per hit and hand it to the
+ * event consumers. Hits pass kt_filter() first.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/kprobes.h>
+#include<linux/tty.h>
+#include<linux/usb.h>
+#include<linux/sched.h>
+#include<linux/string.h>
+
+#include "kprobe_test.h"
+#include "kt_event.h"
+
+struct events_data {
+  u64 ts;
+  s32 tty;
+};
+
+static __always_inline void events_fill(struct kt_event *ev,
+                                        enum kt_probe_id probe,
+                                        enum kt_event_type type, s32 tty,
+                                        u32 len)
+{
+  ev->ts = kt_now();
+  ev->val = 0;
+  ev->len = len;
+  ev->tty = tty;
+  ev->probe = probe;
+  ev->type = type;
+  ev->cpu = smp_processor_id();
+  if (in_task()) {
+    ev->pid = current->pid;
+    memcpy(ev->comm, current->comm, sizeof(ev->comm));
+  } else {
+    ev->pid = 0;
+    memset(ev->comm, 0, sizeof(ev->comm));
+  }
+}
+
+static enum kt_filter_result events_emit(struct kt_event *ev)
+{
+  int flight = kt_flight_enabled() ? kt_flight_record(ev) : -EBUSY;
+  int stream = kt_stream_enabled() ? kt_stream_record(ev) : -EBUSY;
+
+  /* kept if any consumer took it */
+  return flight && stream ? KT_DROPPED : KT_RECORDED;
+}
+
+static int events_entry(struct kretprobe_instance *ri, struct pt_regs *regs,
+                        enum kt_probe_id probe)
+{
+  struct events_data *d = (struct events_data *)ri->data;
+  unsigned long arg0 = regs_get_kernel_argument(regs, 0);
+  u64 start = kt_now();
+  enum kt_filter_result res;
+  struct kt_event ev;
+  u32 len = 0;
+  s32 tty = -1;
+
+  if (probe == KT_PROBE_READ) {
+    /* the completion handler gets the URB, the tty is not known yet */
+    len = ((struct urb *)arg0)->actual_length;
+  } else {
+    tty = arg0 ? ((struct tty_struct *)arg0)->index : -1;
+    if (probe == KT_PROBE_WRITE)
+      len = regs_get_kernel_argument(regs, 2);
+  }
+
+  /* a skipped entry gets no return event either */
+  if (!kt_filter(probe, tty, len, start)) {
+    kt_filter_done(probe, start, KT_SKIPPED);
+    return 1;
+  }
+
+  events_fill(&ev, probe, KT_EV_ENTRY, tty, len);
+  res = events_emit(&ev);
+
+  d->ts = ev.ts;
+  d->tty = tty;
+  kt_filter_done(probe, start, res);
+  return 0;
+}
+
+static int events_ret(struct kretprobe_instance *ri, struct pt_regs *regs,
+                      enum kt_probe_id probe)
+{
+  struct events_data *d = (struct events_data *)ri->data;
+  struct kt_event ev;
+
+  events_fill(&ev, probe, KT_EV_RETURN, d->tty, regs_return_value(regs));
+  ev.val = ev.ts > d->ts ? ev.ts - d->ts : 0;
+  kt_filter_done(probe, ev.ts, events_emit(&ev));
+  return 0;
+}
+
+#define EVENTS_HANDLERS(name, id)                                         \
+static int events_##name##_entry(struct kretprobe_instance *ri,          \
+                                 struct pt_regs *regs)                    \
+{                                                                         \
+  return events_entry(ri, regs, id);                                      \
+}                                                                         \
+static int events_##name##_ret(struct kretprobe_instance *ri,            \
+                               struct pt_regs *regs)                      \
+{                                                                         \
+  return events_ret(ri, regs, id);                                        \
+}
+
+EVENTS_HANDLERS(open, KT_PROBE_OPEN)
+EVENTS_HANDLERS(read, KT_PROBE_READ)
+EVENTS_HANDLERS(write, KT_PROBE_WRITE)
+EVENTS_HANDLERS(close, KT_PROBE_CLOSE)
+
+static struct kretprobe events_probes[KT_PROBE_BASE_NR] = {
+  [KT_PROBE_OPEN]  = { .entry_handler = events_open_entry,
+                       .handler = events_open_ret  },
+  [KT_PROBE_READ]  = { .entry_handler = events_read_entry,
+                       .handler = events_read_ret  },
+  [KT_PROBE_WRITE] = { .entry_handler = events_write_entry,
+                       .handler = events_write_ret },
+  [KT_PROBE_CLOSE] = { .entry_handler = events_close_entry,
+                       .handler = events_close_ret },
+};
+
+static int events_armed;
+
+static void events_disarm(void)
+{
+  for (int i = KT_PROBE_BASE_NR - 1; i >= 0; i--) {
+    if (events_armed & BIT(i))
+      unregister_kretprobe(&events_probes[i]);
+  }
+  events_armed = 0;
+}
+
+static int events_arm(struct module *mod)
+{
+  int retval = 0;
+
+  /* nobody to consume the events */
+  if (!kt_flight_enabled() && !kt_stream_enabled())
+    return 0;
+
+  for (int i = 0; i < KT_PROBE_BASE_NR; i++) {
+    struct kretprobe *rp = &events_probes[i];
+    kretprobe_handler_t entry = rp->entry_handler, handler = rp->handler;
+
+    memset(rp, 0, sizeof(*rp));
+    rp->entry_handler = entry;
+    rp->handler = handler;
+    rp->data_size = sizeof(struct events_data);
+    rp->kp.addr = kt_probe_addr(i);
+    if (!rp->kp.addr) {
+      retval = -ENOENT;
+      break;
+    }
+
+    retval = register_kretprobe(rp);
+    if (retval < 0) {
+      pr_err("Kretprobe registration for %s events failed. Error number: %d",
+             kt_probe_names[i], retval);
+      break;
+    }
+    events_armed |= BIT(i);
+  }
+
+  if (retval < 0)
+    events_disarm();
+  return retval;
+}
+
+const struct kt_feature events_feature = {
+  .name = "events",
+  .arm = events_arm,
+  .disarm = events_disarm,
+};
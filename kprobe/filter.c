@@ -0,0 +1,211 @@
+/*
+ * In-kernel filtering and sampling in front of the event producer. Every
+ * hit goes through kt_filter() before a record is built:
+ *
+ *   - a per-CPU CPU-time budget, spent by the handlers themselves
+ *   - pid/comm predicates (task context only, a URB callback has no
+ *     meaningful current), tty index, and a minimum write size
+ *   - per-probe 1-in-N sampling and a per-probe, per-CPU token bucket
+ *
+ * kt_filter_done() then accounts what happened to the hit and the time
+ * the handler took, which is shown per probe in debugfs "stats".
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/sched.h>
+#include<linux/percpu.h>
+#include<linux/math64.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+
+#include "kprobe_test.h"
+
+static int filter_pid;
+module_param(filter_pid, int, 0644);
+MODULE_PARM_DESC(filter_pid, "Only record hits from this process (tgid), 0 = any");
+
+static char filter_comm[TASK_COMM_LEN];
+module_param_string(filter_comm, filter_comm, sizeof(filter_comm), 0644);
+MODULE_PARM_DESC(filter_comm, "Only record hits from tasks with this comm");
+
+static int filter_tty = -1;
+module_param(filter_tty, int, 0644);
+MODULE_PARM_DESC(filter_tty, "Only record hits on this tty index, -1 = any");
+
+static unsigned int filter_min_len;
+module_param(filter_min_len, uint, 0644);
+MODULE_PARM_DESC(filter_min_len, "Ignore writes shorter than this many bytes");
+
+static unsigned int sample_every[KT_PROBE_BASE_NR];
+module_param_array(sample_every, uint, NULL, 0644);
+MODULE_PARM_DESC(sample_every, "Per probe (open,read,write,close): record 1 in N hits");
+
+static unsigned int sample_rate[KT_PROBE_BASE_NR];
+module_param_array(sample_rate, uint, NULL, 0644);
+MODULE_PARM_DESC(sample_rate, "Per probe (open,read,write,close): max records/s per CPU, 0 = no limit");
+
+static unsigned int cpu_budget_us;
+module_param(cpu_budget_us, uint, 0644);
+MODULE_PARM_DESC(cpu_budget_us, "Handler time allowed per CPU per second, 0 = no limit");
+
+/* a token bucket may save up this many records */
+#define FILTER_BURST 16
+
+struct kt_probe_stats {
+  u64 hits;
+  u64 filtered;
+  u64 sampled;
+  u64 limited;
+  u64 over_budget;
+  u64 recorded;
+  u64 dropped;
+  u64 calls;                /* handler runs, entries and returns */
+  u64 ns;
+};
+
+/* owned by one CPU, handlers never nest there */
+struct filter_cpu {
+  struct kt_probe_stats stats[KT_PROBE_BASE_NR];
+  u32 tick[KT_PROBE_BASE_NR];
+  u64 credit[KT_PROBE_BASE_NR];
+  u64 refill[KT_PROBE_BASE_NR];
+  u64 window_start;
+  u64 window_ns;
+};
+
+static struct filter_cpu __percpu *filter_cpus;
+
+bool kt_filter(enum kt_probe_id probe, s32 tty, u32 len, u64 now)
+{
+  struct filter_cpu *c = this_cpu_ptr(filter_cpus);
+  struct kt_probe_stats *st = &c->stats[probe];
+  unsigned int every, rate, budget;
+  int pid, want_tty;
+
+  st->hits++;
+
+  budget = READ_ONCE(cpu_budget_us);
+  if (budget) {
+    if (now - c->window_start >= NSEC_PER_SEC) {
+      c->window_start = now;
+      c->window_ns = 0;
+    } else if (c->window_ns >= (u64)budget * NSEC_PER_USEC) {
+      st->over_budget++;
+      return false;
+    }
+  }
+
+  if (in_task()) {
+    pid = READ_ONCE(filter_pid);
+    if (pid && current->tgid != pid)
+      goto filtered;
+    if (filter_comm[0] && strncmp(current->comm, filter_comm, TASK_COMM_LEN))
+      goto filtered;
+  }
+
+  want_tty = READ_ONCE(filter_tty);
+  if (want_tty >= 0 && tty >= 0 && tty != want_tty)
+    goto filtered;
+
+  if (probe == KT_PROBE_WRITE && len < READ_ONCE(filter_min_len))
+    goto filtered;
+
+  every = READ_ONCE(sample_every[probe]);
+  if (every > 1 && ++c->tick[probe] % every) {
+    st->sampled++;
+    return false;
+  }
+
+  rate = READ_ONCE(sample_rate[probe]);
+  if (rate) {
+    u64 cost = div_u64(NSEC_PER_SEC, rate);
+
+    c->credit[probe] = min(c->credit[probe] + (now - c->refill[probe]),
+                           cost * FILTER_BURST);
+    c->refill[probe] = now;
+    if (c->credit[probe] < cost) {
+      st->limited++;
+      return false;
+    }
+    c->credit[probe] -= cost;
+  }
+
+  return true;
+
+filtered:
+  st->filtered++;
+  return false;
+}
+
+void kt_filter_done(enum kt_probe_id probe, u64 start, enum kt_filter_result res)
+{
+  struct filter_cpu *c = this_cpu_ptr(filter_cpus);
+  struct kt_probe_stats *st = &c->stats[probe];
+  u64 spent = kt_now() - start;
+
+  if (res == KT_RECORDED)
+    st->recorded++;
+  else if (res == KT_DROPPED)
+    st->dropped++;
+
+  st->calls++;
+  st->ns += spent;
+  c->window_ns += spent;
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+  seq_printf(m, "%-6s %12s %10s %10s %10s %10s %12s %10s %8s %14s\n", "probe",
+             "hits", "filtered", "sampled", "limited", "budget", "recorded",
+             "dropped", "avg_ns", "total_ns");
+
+  for (int p = 0; p < KT_PROBE_BASE_NR; p++) {
+    struct kt_probe_stats sum = {};
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+      const struct kt_probe_stats *st = &per_cpu_ptr(filter_cpus, cpu)->stats[p];
+
+      sum.hits += st->hits;
+      sum.filtered += st->filtered;
+      sum.sampled += st->sampled;
+      sum.limited += st->limited;
+      sum.over_budget += st->over_budget;
+      sum.recorded += st->recorded;
+      sum.dropped += st->dropped;
+      sum.calls += st->calls;
+      sum.ns += st->ns;
+    }
+
+    seq_printf(m, "%-6s %12llu %10llu %10llu %10llu %10llu %12llu %10llu %8llu %14llu\n",
+               kt_probe_names[p], sum.hits, sum.filtered, sum.sampled,
+               sum.limited, sum.over_budget, sum.recorded, sum.dropped,
+               sum.calls ? div64_u64(sum.ns, sum.calls) : 0, sum.ns);
+  }
+
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static int filter_init(struct dentry *dir)
+{
+  filter_cpus = alloc_percpu(struct filter_cpu);
+  if (!filter_cpus)
+    return -ENOMEM;
+
+  debugfs_create_file("stats", 0444, dir, NULL, &stats_fops);
+  return 0;
+}
+
+static void filter_exit(void)
+{
+  free_percpu(filter_cpus);
+}
+
+const struct kt_feature filter_feature = {
+  .name = "filter",
+  .init = filter_init,
+  .exit = filter_exit,
+};
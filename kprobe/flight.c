@@ -0,0 +1,409 @@
+/*
+ * Flight recorder: the event stream is kept in per-CPU overwrite rings.
+ * When a trigger fires (a return slower than a threshold, a write without
+ * a read callback in time, or a manual one) recording goes on for a short
+ * while, then the rings are frozen and the last window of events is copied
+ * into a snapshot that stays around until it is cleared.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/version.h>
+#include<linux/percpu.h>
+#include<linux/atomic.h>
+#include<linux/vmalloc.h>
+#include<linux/timer.h>
+#include<linux/workqueue.h>
+#include<linux/mutex.h>
+#include<linux/sort.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/uaccess.h>
+
+#include "kprobe_test.h"
+#include "kt_event.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete_sync del_timer_sync
+#endif
+
+static bool flight;
+module_param(flight, bool, 0444);
+MODULE_PARM_DESC(flight, "Keep a flight recorder of events (debugfs flight)");
+
+static unsigned int flight_events = 8192;
+module_param(flight_events, uint, 0444);
+MODULE_PARM_DESC(flight_events, "Events kept per CPU, rounded up to a power of 2");
+
+static unsigned int flight_window_ms = 2000;
+module_param(flight_window_ms, uint, 0644);
+MODULE_PARM_DESC(flight_window_ms, "History kept in a snapshot before the trigger, 0 = all");
+
+static unsigned int flight_post_ms = 100;
+module_param(flight_post_ms, uint, 0644);
+MODULE_PARM_DESC(flight_post_ms, "Keep recording this long after the trigger");
+
+static unsigned int flight_lat_us;
+module_param(flight_lat_us, uint, 0644);
+MODULE_PARM_DESC(flight_lat_us, "Trigger on a probed function slower than this, 0 = off");
+
+static unsigned int flight_reply_ms;
+module_param(flight_reply_ms, uint, 0644);
+MODULE_PARM_DESC(flight_reply_ms, "Trigger on a write with no read callback in time, 0 = off");
+
+enum flight_reason {
+  FLIGHT_MANUAL,
+  FLIGHT_LATENCY,
+  FLIGHT_NO_REPLY,
+};
+
+static const char *const flight_reasons[] = {
+  [FLIGHT_MANUAL]   = "manual",
+  [FLIGHT_LATENCY]  = "latency",
+  [FLIGHT_NO_REPLY] = "no reply",
+};
+
+struct flight_ring {
+  u64 head;                 /* events ever written, owned by one CPU */
+  struct kt_event ev[];
+};
+
+static DEFINE_PER_CPU(struct flight_ring *, flight_rings);
+static u32 flight_mask;
+
+struct flight_snapshot {
+  enum flight_reason reason;
+  int probe;
+  u64 value;
+  u64 trigger_ts;
+  size_t nr;
+  struct kt_event ev[];
+};
+
+/* producers skip the rings while they are being copied */
+static int flight_frozen;
+
+/* set by the first trigger, cleared when the snapshot is thrown away */
+static int flight_triggered;
+static enum flight_reason flight_trig_reason;
+static int flight_trig_probe;
+static u64 flight_trig_value;
+static u64 flight_trig_ts;
+/* bumped from the probe handlers on any CPU */
+static atomic64_t flight_ignored = ATOMIC64_INIT(0);
+
+static u64 flight_pending_write;
+static struct timer_list flight_reply_timer;
+static struct delayed_work flight_freeze_work;
+
+/* guards flight_snap against readers and clears */
+static DEFINE_MUTEX(flight_lock);
+static struct flight_snapshot *flight_snap;
+
+bool kt_flight_enabled(void)
+{
+  return flight;
+}
+
+static void flight_trigger(enum flight_reason reason, int probe, u64 value,
+                           u64 ts)
+{
+  if (cmpxchg(&flight_triggered, 0, 1)) {
+    atomic64_inc(&flight_ignored);
+    return;
+  }
+
+  flight_trig_reason = reason;
+  flight_trig_probe = probe;
+  flight_trig_value = value;
+  flight_trig_ts = ts;
+  schedule_delayed_work(&flight_freeze_work,
+                        msecs_to_jiffies(READ_ONCE(flight_post_ms)));
+}
+
+int kt_flight_record(const struct kt_event *ev)
+{
+  struct flight_ring *r;
+  unsigned int lat_us, reply_ms;
+
+  if (!flight || READ_ONCE(flight_frozen))
+    return -EBUSY;
+
+  r = __this_cpu_read(flight_rings);
+  r->ev[r->head & flight_mask] = *ev;
+  WRITE_ONCE(r->head, r->head + 1);
+
+  if (ev->type == KT_EV_RETURN) {
+    lat_us = READ_ONCE(flight_lat_us);
+    if (lat_us && ev->val > (u64)lat_us * NSEC_PER_USEC)
+      flight_trigger(FLIGHT_LATENCY, ev->probe, ev->val, ev->ts);
+  }
+
+  if (ev->probe == KT_PROBE_WRITE && ev->type == KT_EV_RETURN) {
+    reply_ms = READ_ONCE(flight_reply_ms);
+    /* only the oldest unanswered write is timed */
+    if (reply_ms && !cmpxchg(&flight_pending_write, 0, ev->ts))
+      mod_timer(&flight_reply_timer, jiffies + msecs_to_jiffies(reply_ms));
+  } else if (ev->probe == KT_PROBE_READ && ev->type == KT_EV_ENTRY) {
+    WRITE_ONCE(flight_pending_write, 0);
+  }
+
+  return 0;
+}
+
+static void flight_reply_timeout(struct timer_list *t)
+{
+  u64 pending = READ_ONCE(flight_pending_write);
+  u64 limit = (u64)READ_ONCE(flight_reply_ms) * NSEC_PER_MSEC;
+  u64 now = kt_now();
+
+  if (!pending || !limit)
+    return;
+
+  /* answered and written again since the timer was set */
+  if (now - pending < limit) {
+    mod_timer(&flight_reply_timer,
+              jiffies + msecs_to_jiffies(div_u64(limit - (now - pending),
+                                                 NSEC_PER_MSEC) + 1));
+    return;
+  }
+
+  if (cmpxchg(&flight_pending_write, pending, 0) == pending)
+    flight_trigger(FLIGHT_NO_REPLY, KT_PROBE_WRITE, now - pending, now);
+}
+
+static int flight_ev_cmp(const void *a, const void *b)
+{
+  const struct kt_event *ea = a, *eb = b;
+
+  if (ea->ts == eb->ts)
+    return 0;
+  return ea->ts < eb->ts ? -1 : 1;
+}
+
+static void flight_freeze(struct work_struct *work)
+{
+  u64 from = 0, window = (u64)READ_ONCE(flight_window_ms) * NSEC_PER_MSEC;
+  struct flight_snapshot *snap;
+  size_t nr = 0;
+  int cpu;
+
+  WRITE_ONCE(flight_frozen, 1);
+  /* handlers run with preemption off, let the last stores land */
+  synchronize_rcu();
+
+  if (window && flight_trig_ts > window)
+    from = flight_trig_ts - window;
+
+  for_each_possible_cpu(cpu) {
+    struct flight_ring *r = per_cpu(flight_rings, cpu);
+    u64 n = min_t(u64, r->head, flight_mask + 1);
+
+    for (u64 seq = r->head - n; seq < r->head; seq++)
+      nr += r->ev[seq & flight_mask].ts >= from;
+  }
+
+  snap = vmalloc(struct_size(snap, ev, nr));
+  if (!snap) {
+    pr_err("flight: no memory for a snapshot of %zu events", nr);
+    WRITE_ONCE(flight_triggered, 0);
+    goto out_thaw;
+  }
+
+  snap->reason = flight_trig_reason;
+  snap->probe = flight_trig_probe;
+  snap->value = flight_trig_value;
+  snap->trigger_ts = flight_trig_ts;
+  snap->nr = 0;
+
+  for_each_possible_cpu(cpu) {
+    struct flight_ring *r = per_cpu(flight_rings, cpu);
+    u64 n = min_t(u64, r->head, flight_mask + 1);
+
+    for (u64 seq = r->head - n; seq < r->head && snap->nr < nr; seq++) {
+      if (r->ev[seq & flight_mask].ts >= from)
+        snap->ev[snap->nr++] = r->ev[seq & flight_mask];
+    }
+  }
+
+  sort(snap->ev, snap->nr, sizeof(snap->ev[0]), flight_ev_cmp, NULL);
+
+  mutex_lock(&flight_lock);
+  vfree(flight_snap);
+  flight_snap = snap;
+  mutex_unlock(&flight_lock);
+
+  pr_info("%s: flight recorder snapshot (%s), %zu events", target,
+          flight_reasons[snap->reason], snap->nr);
+
+out_thaw:
+  WRITE_ONCE(flight_frozen, 0);
+}
+
+static void flight_clear(void)
+{
+  mutex_lock(&flight_lock);
+  vfree(flight_snap);
+  flight_snap = NULL;
+  mutex_unlock(&flight_lock);
+  WRITE_ONCE(flight_triggered, 0);
+}
+
+static void *flight_seq_start(struct seq_file *m, loff_t *pos)
+{
+  mutex_lock(&flight_lock);
+  if (!flight_snap)
+    return *pos ? NULL : SEQ_START_TOKEN;
+  return *pos <= flight_snap->nr ? pos : NULL;
+}
+
+static void *flight_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+  ++*pos;
+  return flight_snap && *pos <= flight_snap->nr ? pos : NULL;
+}
+
+static void flight_seq_stop(struct seq_file *m, void *v)
+{
+  mutex_unlock(&flight_lock);
+}
+
+static int flight_seq_show(struct seq_file *m, void *v)
+{
+  const struct kt_event *ev;
+  s64 rel;
+
+  if (v == SEQ_START_TOKEN) {
+    seq_printf(m, "no snapshot, %s\n",
+               READ_ONCE(flight_triggered) ? "one is being taken" : "waiting for a trigger");
+    return 0;
+  }
+
+  /* position 0 is the header, events follow */
+  if (*(loff_t *)v == 0) {
+    seq_printf(m, "trigger %s on %s, value %llu ns, %zu events, %llu later triggers ignored\n",
+               flight_reasons[flight_snap->reason],
+               kt_probe_names[flight_snap->probe], flight_snap->value,
+               flight_snap->nr, (u64)atomic64_read(&flight_ignored));
+    seq_printf(m, "%14s %4s %8s %-16s %-6s %-6s %4s %10s %12s\n", "rel_us", "cpu",
+               "pid", "comm", "probe", "type", "tty", "len", "val_ns");
+    return 0;
+  }
+
+  ev = &flight_snap->ev[*(loff_t *)v - 1];
+  rel = (s64)(ev->ts - flight_snap->trigger_ts);
+  seq_printf(m, "%14lld %4u %8u %-16.16s %-6s %-6s %4d %10u %12llu\n",
+             div_s64(rel, NSEC_PER_USEC), ev->cpu, ev->pid, ev->comm,
+             ev->probe < KT_PROBE_BASE_NR ? kt_probe_names[ev->probe] : "?",
+             ev->type == KT_EV_RETURN ? "return" : "entry", ev->tty, ev->len,
+             ev->val);
+  return 0;
+}
+
+static const struct seq_operations flight_seq_ops = {
+  .start = flight_seq_start,
+  .next = flight_seq_next,
+  .stop = flight_seq_stop,
+  .show = flight_seq_show,
+};
+
+static int flight_open(struct inode *inode, struct file *file)
+{
+  return seq_open(file, &flight_seq_ops);
+}
+
+/* "trigger" takes a snapshot now, "clear" drops it and re-arms triggers */
+static ssize_t flight_write(struct file *file, const char __user *ubuf,
+                            size_t len, loff_t *ppos)
+{
+  char buf[16];
+
+  if (len >= sizeof(buf))
+    return -EINVAL;
+  if (copy_from_user(buf, ubuf, len))
+    return -EFAULT;
+  buf[len] = '\0';
+
+  if (sysfs_streq(buf, "trigger"))
+    flight_trigger(FLIGHT_MANUAL, KT_PROBE_WRITE, 0, kt_now());
+  else if (sysfs_streq(buf, "clear"))
+    flight_clear();
+  else
+    return -EINVAL;
+
+  return len;
+}
+
+static const struct file_operations flight_fops = {
+  .owner = THIS_MODULE,
+  .open = flight_open,
+  .read = seq_read,
+  .write = flight_write,
+  .llseek = seq_lseek,
+  .release = seq_release,
+};
+
+static void flight_exit(void)
+{
+  int cpu;
+
+  if (!flight)
+    return;
+
+  cancel_delayed_work_sync(&flight_freeze_work);
+  vfree(flight_snap);
+  flight_snap = NULL;
+
+  for_each_possible_cpu(cpu) {
+    vfree(per_cpu(flight_rings, cpu));
+    per_cpu(flight_rings, cpu) = NULL;
+  }
+}
+
+static int flight_init(struct dentry *dir)
+{
+  u32 size = roundup_pow_of_two(max(flight_events, 64U));
+  int cpu;
+
+  if (!flight)
+    return 0;
+
+  flight_mask = size - 1;
+  timer_setup(&flight_reply_timer, flight_reply_timeout, 0);
+  INIT_DELAYED_WORK(&flight_freeze_work, flight_freeze);
+
+  for_each_possible_cpu(cpu) {
+    struct flight_ring *r = vzalloc_node(struct_size(r, ev, size), cpu_to_node(cpu));
+
+    per_cpu(flight_rings, cpu) = r;
+    if (!r) {
+      flight_exit();
+      return -ENOMEM;
+    }
+  }
+
+  debugfs_create_file("flight", 0644, dir, NULL, &flight_fops);
+  return 0;
+}
+
+static int flight_arm(struct module *mod)
+{
+  WRITE_ONCE(flight_pending_write, 0);
+  return 0;
+}
+
+static void flight_disarm(void)
+{
+  /* the events are gone already, a pending freeze still completes */
+  if (flight)
+    timer_delete_sync(&flight_reply_timer);
+}
+
+const struct kt_feature flight_feature = {
+  .name = "flight",
+  .init = flight_init,
+  .exit = flight_exit,
+  .arm = flight_arm,
+  .disarm = flight_disarm,
+};
@@ -0,0 +1,38 @@
+#include<linux/kernel.h>
+#include<linux/seq_file.h>
+#include<linux/math64.h>
+
+#include "kprobe_test.h"
+
+void kt_hist_merge(struct kt_hist *dst, const struct kt_hist *src)
+{
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  for (int i = 0; i < KT_HIST_BUCKETS; i++)
+    dst->bucket[i] += src->bucket[i];
+}
+
+void kt_hist_show(struct seq_file *m, const char *title,
+                  const char *unit, const struct kt_hist *h)
+{
+  u64 peak = 0;
+
+  seq_printf(m, "%s: count %llu avg %llu max %llu %s\n", title, h->count,
+             h->count ? div64_u64(h->sum, h->count) : 0, h->max, unit);
+
+  for (int i = 0; i < KT_HIST_BUCKETS; i++)
+    peak = max(peak, h->bucket[i]);
+
+  for (int i = 0; i < KT_HIST_BUCKETS; i++) {
+    u64 lo = i ? 1ULL << (i - 1) : 0;
+    u64 hi = i ? 1ULL << i : 1;
+
+    if (!h->bucket[i])
+      continue;
+    seq_printf(m, "  %12llu -> %-12llu %10llu |%.*s\n", lo, hi, h->bucket[i],
+               (int)div64_u64(h->bucket[i] * 40, peak),
+               "########################################");
+  }
+}
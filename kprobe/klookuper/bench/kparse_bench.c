@@ -0,0 +1,444 @@
+/*
+ * Userspace harness for the klookuper kallsyms parser. kallsyms_parse.c
+ * has no kernel dependencies, so this builds the very file the module
+ * links. For every dump it:
+ *
+ *   - parses it with a plain sscanf reference parser,
+ *   - re-parses it with kallsyms_parse() through read buffers of several
+ *     sizes, so lines straddle reads at every offset, and compares every
+ *     field against the reference,
+ *   - times full scans (MB/s), single lookups that stop at their match
+ *     (lookups/s) and one batched pass resolving many names.
+ *
+ *   ./kparse_bench [-n lookups] [-r repeats] dump...
+ *   ./kparse_bench -g lines        synthetic dump of that many lines
+ *
+ * Dumps are just `cat /proc/kallsyms > file`, as root for real addresses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "kallsyms_parse.h"
+
+struct ref_sym {
+    unsigned long addr;
+    char type;
+    char *name;
+    char *mod;                  /* NULL for vmlinux */
+};
+
+struct dump {
+    const char *path;
+    char *text;
+    size_t len;
+    struct ref_sym *syms;
+    size_t nr;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *xstrndup(const char *s, size_t len)
+{
+    char *d = malloc(len + 1);
+
+    if (!d) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(d, s, len);
+    d[len] = '\0';
+    return d;
+}
+
+/* the obvious line by line parser the fast one is checked against */
+static int ref_parse(struct dump *d)
+{
+    size_t max = 0;
+    char *p = d->text, *end = d->text + d->len;
+
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        char *line, name[512], mod[512], type;
+        unsigned long addr;
+        int n;
+
+        if (!nl) { nl = end; }
+        line = xstrndup(p, nl - p);
+        p = nl + 1;
+        if (!*line) {
+            free(line);
+            continue;
+        }
+
+        if (d->nr == max) {
+            max = max ? max * 2 : 4096;
+            d->syms = realloc(d->syms, max * sizeof(*d->syms));
+            if (!d->syms) {
+                perror("realloc");
+                return -1;
+            }
+        }
+
+        n = sscanf(line, "%lx %c %511s [%511[^]]]", &addr, &type, name, mod);
+        free(line);
+        if (n < 3) {
+            fprintf(stderr, "%s: reference parser choked on line %zu\n",
+                    d->path, d->nr + 1);
+            return -1;
+        }
+
+        d->syms[d->nr].addr = addr;
+        d->syms[d->nr].type = type;
+        d->syms[d->nr].name = strdup(name);
+        d->syms[d->nr].mod = n == 4 ? strdup(mod) : NULL;
+        d->nr++;
+    }
+
+    return 0;
+}
+
+struct check {
+    const struct dump *d;
+    size_t line;
+    size_t errors;
+};
+
+static int check_line(const struct ksym_line *line, void *data)
+{
+    struct check *c = data;
+    const struct ref_sym *ref;
+    unsigned long addr;
+
+    if (c->line >= c->d->nr) {
+        c->errors++;
+        return 1;
+    }
+    ref = &c->d->syms[c->line++];
+
+    if (kallsyms_parse_addr(line, &addr) || addr != ref->addr
+        || line->type != ref->type
+        || !ksym_line_name_is(line, ref->name, strlen(ref->name))
+        || (!line->mod) != (!ref->mod)
+        || (ref->mod && (line->mod_len != strlen(ref->mod)
+                         || memcmp(line->mod, ref->mod, line->mod_len)))) {
+        if (c->errors++ < 5) {
+            fprintf(stderr, "%s: line %zu differs: %.*s / %s\n", c->d->path,
+                    c->line, (int)line->name_len, line->name, ref->name);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Feeds the dump through a read buffer of bufsize bytes the way the
+ * module's read loop does: parse, carry the unfinished line, refill.
+ */
+static int stream(const struct dump *d, size_t bufsize, ksym_line_fn fn,
+                  void *data)
+{
+    char *buf = malloc(bufsize);
+    size_t off = 0, carry = 0;
+    int stop = 0;
+
+    if (!buf) { return -ENOMEM; }
+
+    for (;;) {
+        size_t n = d->len - off, used;
+
+        if (n > bufsize - carry) { n = bufsize - carry; }
+        memcpy(buf + carry, d->text + off, n);
+        off += n;
+
+        used = kallsyms_parse(buf, carry + n, n == 0, fn, data, &stop);
+        if (stop || n == 0) { break; }
+
+        carry = carry + n - used;
+        if (carry == bufsize) {
+            stop = -EINVAL;
+            break;
+        }
+        memmove(buf, buf + used, carry);
+    }
+
+    free(buf);
+    return stop;
+}
+
+static int check_dump(const struct dump *d)
+{
+    static const size_t sizes[] = { 256, 1000, 4096, 65536, 1 << 20 };
+    size_t errors = 0;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct check c = { .d = d };
+        int ret = stream(d, sizes[i], check_line, &c);
+
+        if (ret < 0 || c.line != d->nr) {
+            fprintf(stderr, "%s: %zu byte reads: parse error %d after %zu of %zu lines\n",
+                    d->path, sizes[i], ret, c.line, d->nr);
+            c.errors++;
+        }
+        errors += c.errors;
+    }
+
+    printf("%s: %zu lines, %zu bytes, %s\n", d->path, d->nr, d->len,
+           errors ? "MISMATCH" : "matches the reference");
+    return errors ? -1 : 0;
+}
+
+static int count_line(const struct ksym_line *line, void *data)
+{
+    (void)line;
+    (*(size_t *)data)++;
+    return 0;
+}
+
+/* one name, stops at the first hit, like a procfs lookup */
+struct single {
+    const char *name;
+    size_t len;
+    unsigned long addr;
+};
+
+static int single_line(const struct ksym_line *line, void *data)
+{
+    struct single *s = data;
+
+    if (!ksym_line_name_is(line, s->name, s->len)) { return 0; }
+    return kallsyms_parse_addr(line, &s->addr) ? -EINVAL : 1;
+}
+
+/* many names in one pass: a length filter, then an open addressing set */
+struct batch {
+    const char **names;
+    size_t *lens;
+    unsigned long *addrs;
+    uint32_t *slots;            /* name index + 1 */
+    uint32_t mask;
+    uint64_t name_lens;
+    size_t pending;
+};
+
+static uint32_t hash_name(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) { h = (h ^ (unsigned char)*s++) * 16777619u; }
+    return h;
+}
+
+static int batch_line(const struct ksym_line *line, void *data)
+{
+    struct batch *b = data;
+    uint32_t i;
+
+    if (!(b->name_lens & (1ULL << (line->name_len % 64)))) { return 0; }
+
+    for (i = hash_name(line->name, line->name_len) & b->mask; b->slots[i];
+         i = (i + 1) & b->mask) {
+        uint32_t q = b->slots[i] - 1;
+
+        if (b->addrs[q] || !ksym_line_name_is(line, b->names[q], b->lens[q])) {
+            continue;
+        }
+        if (kallsyms_parse_addr(line, &b->addrs[q]) || !b->addrs[q]) {
+            b->addrs[q] = 1;    /* zeroed addresses of a non-root dump */
+        }
+        b->pending--;
+    }
+
+    return b->pending == 0;
+}
+
+static void bench_dump(const struct dump *d, size_t lookups, int repeats)
+{
+    const char **names = malloc(lookups * sizeof(*names));
+    size_t lines = 0, found = 0;
+    struct batch b = { 0 };
+    uint32_t size = 1;
+    double t;
+
+    /* full scans, the cost of a miss or of filling the module's cache */
+    t = now_sec();
+    for (int r = 0; r < repeats; r++) { stream(d, 65536, count_line, &lines); }
+    t = (now_sec() - t) / repeats;
+    printf("  full scan     %8.2f ms  %8.0f MB/s  %8.1f Mlines/s\n", t * 1e3,
+           d->len / t / 1e6, d->nr / t / 1e6);
+
+    /* names spread over the table, so a lookup scans half of it on average */
+    srand(1);
+    for (size_t i = 0; i < lookups; i++) {
+        names[i] = d->syms[(size_t)rand() % d->nr].name;
+    }
+
+    t = now_sec();
+    for (size_t i = 0; i < lookups; i++) {
+        struct single s = { .name = names[i], .len = strlen(names[i]) };
+        found += stream(d, 65536, single_line, &s) > 0;
+    }
+    t = now_sec() - t;
+    printf("  single lookup %8.2f ms  %8.0f lookups/s  (%zu/%zu found)\n",
+           t * 1e3 / lookups, lookups / t, found, lookups);
+
+    while (size < lookups * 2) { size <<= 1; }
+    b.names = names;
+    b.lens = calloc(lookups, sizeof(*b.lens));
+    b.addrs = calloc(lookups, sizeof(*b.addrs));
+    b.slots = calloc(size, sizeof(*b.slots));
+    b.mask = size - 1;
+    b.pending = lookups;
+    for (size_t i = 0; i < lookups; i++) {
+        uint32_t slot;
+
+        b.lens[i] = strlen(names[i]);
+        b.name_lens |= 1ULL << (b.lens[i] % 64);
+        slot = hash_name(names[i], b.lens[i]) & b.mask;
+        while (b.slots[slot]) { slot = (slot + 1) & b.mask; }
+        b.slots[slot] = i + 1;
+    }
+
+    t = now_sec();
+    stream(d, 65536, batch_line, &b);
+    t = now_sec() - t;
+    printf("  batch of %-4zu %8.2f ms  %8.0f lookups/s  (%zu unresolved)\n",
+           lookups, t * 1e3, lookups / t, b.pending);
+
+    free(b.lens);
+    free(b.addrs);
+    free(b.slots);
+    free(names);
+}
+
+static int load_dump(struct dump *d, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    size_t max = 1 << 20;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    d->path = path;
+    d->text = malloc(max);
+    while (d->text) {
+        d->len += fread(d->text + d->len, 1, max - d->len, fp);
+        if (d->len < max) { break; }
+        max *= 2;
+        d->text = realloc(d->text, max);
+    }
+    fclose(fp);
+
+    return d->text ? ref_parse(d) : -1;
+}
+
+/* vmlinux-like names first, then module symbols, like the real file */
+static int gen_dump(struct dump *d, size_t lines)
+{
+    static const char types[] = "TtDdBbRrW";
+    size_t max = lines * 80 + 1;
+    char *p;
+
+    d->path = "synthetic";
+    d->text = p = malloc(max);
+    if (!p) { return -1; }
+
+    srand(lines);
+    for (size_t i = 0; i < lines; i++) {
+        unsigned long addr = 0xffffffff81000000UL + i * 16;
+        char type = types[rand() % (sizeof(types) - 1)];
+
+        if (i < lines * 9 / 10) {
+            p += sprintf(p, "%016lx %c sym_%zu_%x\n", addr, type, i, rand() & 0xffff);
+        } else {
+            p += sprintf(p, "%016lx %c modsym_%zu\t[mod_%zu]\n", addr, type, i, i % 37);
+        }
+    }
+    d->len = p - d->text;
+
+    return ref_parse(d);
+}
+
+static void free_dump(struct dump *d)
+{
+    for (size_t i = 0; i < d->nr; i++) {
+        free(d->syms[i].name);
+        free(d->syms[i].mod);
+    }
+    free(d->syms);
+    free(d->text);
+}
+
+static int run(struct dump *d, size_t lookups, int repeats)
+{
+    int ret = check_dump(d);
+
+    if (d->nr) { bench_dump(d, lookups, repeats); }
+    free_dump(d);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n lookups] [-r repeats] [-g lines] [dump...]\n"
+            "  -n  names per lookup benchmark (default 100)\n"
+            "  -r  full scans to average (default 10)\n"
+            "  -g  also check and time a synthetic dump of this many lines\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    size_t lookups = 100, gen = 0;
+    int repeats = 10, opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "n:r:g:h")) != -1) {
+        switch (opt) {
+        case 'n': lookups = strtoul(optarg, NULL, 0); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 'g': gen = strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!lookups || repeats < 1 || (optind == argc && !gen)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        struct dump d = { 0 };
+
+        if (load_dump(&d, argv[i])) {
+            failed = 1;
+            continue;
+        }
+        failed |= run(&d, lookups, repeats) != 0;
+    }
+
+    if (gen) {
+        struct dump d = { 0 };
+
+        if (gen_dump(&d, gen)) {
+            return 1;
+        }
+        failed |= run(&d, lookups, repeats) != 0;
+    }
+
+    return failed;
+}
@@ -0,0 +1,804 @@
+/**
+ * Symbol cache for klookuper. The whole symbol table is loaded from
+ * `/proc/kallsyms` on first use into three flat arrays: the symbols, a
+ * string table holding their names and an open addressing hash index over
+ * the names. A lookup is one hash probe run, with no file or credentials
+ * involved.
+ *
+ * Each loaded module gets its own module slot. A module notifier marks the
+ * slot dead when the module goes away, so its symbols are skipped, and
+ * fills a fresh slot from the module's own symbol table when a module comes
+ * up, so loading or reloading a module does not rescan `/proc/kallsyms`.
+ * When dead symbols make up half of the cache, the next use compacts the
+ * live ones in place. Only running out of memory, or an arch where module
+ * symbol values are function descriptors, drops the cache for a full
+ * rebuild from `/proc/kallsyms`.
+ *
+ * Reverse lookups use a fourth array, the live symbols sorted by address
+ * with their sizes, binary searched. It is rebuilt on the first reverse
+ * lookup after the set of live symbols changed.
+ *
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+*/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/jhash.h>
+#include <linux/mm.h>
+#include <linux/sort.h>
+#include <linux/version.h>
+
+#include "lookuper.h"
+#include "lookuper_internal.h"
+
+#define KCACHE_INIT_SYMS    (1 << 16)
+#define KCACHE_INIT_STRS    (1 << 20)
+#define KCACHE_INIT_MODS    64
+#define KCACHE_MAX_MODS     U16_MAX
+
+/*
+ * A module's st_value is only its symbol's address where functions have
+ * no descriptors; elsewhere kallsyms_symbol_value(), which is internal,
+ * has to dereference it. There a module load drops the cache instead.
+ */
+#if defined(CONFIG_HAVE_FUNCTION_DESCRIPTORS) || defined(CONFIG_IA64) \
+    || defined(CONFIG_PARISC64) \
+    || (defined(CONFIG_PPC64) && (!defined(_CALL_ELF) || _CALL_ELF != 2))
+#define KCACHE_MOD_SYMTAB   0
+#else
+#define KCACHE_MOD_SYMTAB   1
+#endif
+
+enum kcache_mod_state {
+    KCACHE_MOD_LOADED,
+    KCACHE_MOD_DEAD,        /* unloaded, its symbols are skipped */
+};
+
+struct kcache_sym {
+    unsigned long addr;
+    u32 name_off;           /* into kcache.strs */
+    u16 mod_id;             /* into kcache.mods, 0 is vmlinux */
+    char type;
+};
+
+struct kcache_addr {
+    unsigned long addr;
+    u32 size;               /* up to the next symbol, 0 when unknown */
+    u32 sym;                /* into kcache.syms, for name and module */
+};
+
+struct kcache_mod {
+    char name[MODULE_NAME_LEN];
+    enum kcache_mod_state state;
+    u32 first_sym;          /* a module's symbols are added in one run */
+    u32 nr_syms;
+};
+
+static DEFINE_MUTEX(kcache_lock);
+
+/* all but enabled under kcache_lock */
+static struct {
+    bool enabled;
+    bool built;
+
+    struct kcache_sym *syms;
+    u32 nr_syms, max_syms, dead_syms;
+
+    char *strs;
+    u32 strs_len, strs_max;
+
+    u32 *index;             /* symbol index + 1, 0 is empty */
+    u32 index_mask;
+
+    struct kcache_mod *mods;
+    u32 nr_mods, max_mods;
+
+    struct kcache_addr *addrs;
+    u32 nr_addrs;
+    bool addrs_stale;
+} kcache;
+
+static u32 kcache_hash(const char *name)
+{
+    return jhash(name, strlen(name), 0);
+}
+
+/* kvmalloc'ed arrays have no portable realloc, grow by copying */
+static int kcache_grow(void **array, u32 *max, u32 used, size_t elem, u32 init)
+{
+    u32 new_max = *max ? *max * 2 : init;
+    void *bigger;
+
+    bigger = kvmalloc_array(new_max, elem, GFP_KERNEL);
+    if (!bigger) {
+        return -ENOMEM;
+    }
+
+    if (*array) {
+        memcpy(bigger, *array, (size_t)used * elem);
+        kvfree(*array);
+    }
+    *array = bigger;
+    *max = new_max;
+
+    return 0;
+}
+
+static void kcache_free(void)
+{
+    kvfree(kcache.syms);
+    kvfree(kcache.strs);
+    kvfree(kcache.index);
+    kvfree(kcache.mods);
+    kvfree(kcache.addrs);
+
+    kcache.syms = NULL;
+    kcache.strs = NULL;
+    kcache.index = NULL;
+    kcache.mods = NULL;
+    kcache.addrs = NULL;
+    kcache.nr_addrs = 0;
+    kcache.addrs_stale = true;
+    kcache.nr_syms = kcache.max_syms = kcache.dead_syms = 0;
+    kcache.strs_len = kcache.strs_max = 0;
+    kcache.index_mask = 0;
+    kcache.nr_mods = kcache.max_mods = 0;
+    kcache.built = false;
+}
+
+static void kcache_index_insert(u32 *index, u32 mask, u32 sym)
+{
+    u32 slot = kcache_hash(kcache.strs + kcache.syms[sym].name_off) & mask;
+
+    while (index[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = sym + 1;
+}
+
+/* keeps the index at most half full, re-inserting in symbol order */
+static int kcache_index_fit(u32 nr)
+{
+    u32 size = kcache.index_mask + 1;
+    u32 *index;
+
+    if (kcache.index && nr * 2 <= size) {
+        return 0;
+    }
+
+    size = roundup_pow_of_two(max_t(u32, nr * 2, KCACHE_INIT_SYMS * 2));
+    index = kvcalloc(size, sizeof(*index), GFP_KERNEL);
+    if (!index) {
+        return -ENOMEM;
+    }
+
+    for (u32 i = 0; i < kcache.nr_syms; i++) {
+        kcache_index_insert(index, size - 1, i);
+    }
+
+    kvfree(kcache.index);
+    kcache.index = index;
+    kcache.index_mask = size - 1;
+
+    return 0;
+}
+
+static int kcache_mod_is(const struct kcache_mod *mod, const char *name,
+                         size_t len)
+{
+    return len < sizeof(mod->name) && !strncmp(mod->name, name, len)
+           && mod->name[len] == '\0';
+}
+
+static int kcache_add_mod(const char *name, size_t len,
+                          enum kcache_mod_state state)
+{
+    struct kcache_mod *mod;
+    int ret;
+
+    if (kcache.nr_mods >= KCACHE_MAX_MODS) {
+        return -ENOSPC;
+    }
+
+    if (kcache.nr_mods == kcache.max_mods) {
+        ret = kcache_grow((void **)&kcache.mods, &kcache.max_mods,
+                          kcache.nr_mods, sizeof(*kcache.mods),
+                          KCACHE_INIT_MODS);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    mod = &kcache.mods[kcache.nr_mods];
+    len = min(len, sizeof(mod->name) - 1);
+    memcpy(mod->name, name, len);
+    mod->name[len] = '\0';
+    mod->state = state;
+    mod->nr_syms = 0;
+
+    return kcache.nr_mods++;
+}
+
+static int kcache_add_sym(const char *name, size_t name_len,
+                          unsigned long addr, char type, u16 mod_id)
+{
+    size_t len = name_len + 1;
+    struct kcache_sym *sym;
+    int ret;
+
+    if (kcache.nr_syms == kcache.max_syms) {
+        ret = kcache_grow((void **)&kcache.syms, &kcache.max_syms,
+                          kcache.nr_syms, sizeof(*kcache.syms),
+                          KCACHE_INIT_SYMS);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    while (kcache.strs_len + len > kcache.strs_max) {
+        ret = kcache_grow((void **)&kcache.strs, &kcache.strs_max,
+                          kcache.strs_len, 1, KCACHE_INIT_STRS);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    ret = kcache_index_fit(kcache.nr_syms + 1);
+    if (ret) {
+        return ret;
+    }
+
+    sym = &kcache.syms[kcache.nr_syms];
+    sym->addr = addr;
+    sym->name_off = kcache.strs_len;
+    sym->mod_id = mod_id;
+    sym->type = type;
+
+    memcpy(kcache.strs + kcache.strs_len, name, name_len);
+    kcache.strs[kcache.strs_len + name_len] = '\0';
+    kcache.strs_len += len;
+
+    if (!kcache.mods[mod_id].nr_syms) {
+        kcache.mods[mod_id].first_sym = kcache.nr_syms;
+    }
+    kcache_index_insert(kcache.index, kcache.index_mask, kcache.nr_syms++);
+    kcache.mods[mod_id].nr_syms++;
+
+    return 0;
+}
+
+struct kcache_scan {
+    int last_mod;           /* lines come grouped by module */
+};
+
+static int kcache_scan_line(const struct ksym_line *line, void *data)
+{
+    struct kcache_scan *scan = data;
+    unsigned long addr;
+    int mod_id = 0;
+
+    if (kallsyms_parse_addr(line, &addr)) {
+        return -EINVAL;
+    }
+
+    if (line->mod) {
+        mod_id = scan->last_mod;
+        if (mod_id < 0
+            || !kcache_mod_is(&kcache.mods[mod_id], line->mod, line->mod_len)) {
+            mod_id = kcache_add_mod(line->mod, line->mod_len, KCACHE_MOD_LOADED);
+            if (mod_id < 0) {
+                return mod_id;
+            }
+        }
+        scan->last_mod = mod_id;
+    }
+
+    return kcache_add_sym(line->name, line->name_len, addr, line->type, mod_id);
+}
+
+static int kcache_build(void)
+{
+    struct kcache_scan scan = { .last_mod = -1 };
+    int ret;
+
+    kcache_free();
+
+    /* mod_id 0 stands for vmlinux */
+    ret = kcache_add_mod("", 0, KCACHE_MOD_LOADED);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = kallsyms_scan(kcache_scan_line, &scan);
+    if (ret) {
+        printk(KERN_ERR "Failed to build the kallsyms cache: %d\n", ret);
+        kcache_free();
+        return ret;
+    }
+
+    kcache.built = true;
+    return 0;
+}
+
+/*
+ * Drops the dead modules' symbols, names and slots in place and rebuilds
+ * the index over what is left. Names were appended in symbol order, so
+ * each one moves down, never over one still to be moved.
+ */
+static int kcache_compact(void)
+{
+    u32 nr_syms = 0, strs_len = 0, nr_mods = 0;
+    u16 *mod_ids;               /* new slot per old one, U16_MAX when dead */
+    u32 *index;
+
+    mod_ids = kvmalloc_array(kcache.nr_mods, sizeof(*mod_ids), GFP_KERNEL);
+    index = kvcalloc(kcache.index_mask + 1, sizeof(*index), GFP_KERNEL);
+    if (!mod_ids || !index) {
+        kvfree(mod_ids);
+        kvfree(index);
+        return -ENOMEM;
+    }
+
+    for (u32 i = 0; i < kcache.nr_mods; i++) {
+        if (kcache.mods[i].state == KCACHE_MOD_DEAD) {
+            mod_ids[i] = U16_MAX;
+            continue;
+        }
+        mod_ids[i] = nr_mods;
+        kcache.mods[nr_mods] = kcache.mods[i];
+        kcache.mods[nr_mods++].nr_syms = 0;
+    }
+
+    for (u32 i = 0; i < kcache.nr_syms; i++) {
+        struct kcache_sym *sym = &kcache.syms[i];
+        u16 mod_id = mod_ids[sym->mod_id];
+        size_t len = strlen(kcache.strs + sym->name_off) + 1;
+
+        if (mod_id == U16_MAX) {
+            continue;
+        }
+
+        memmove(kcache.strs + strs_len, kcache.strs + sym->name_off, len);
+        kcache.syms[nr_syms] = *sym;
+        kcache.syms[nr_syms].name_off = strs_len;
+        kcache.syms[nr_syms].mod_id = mod_id;
+        strs_len += len;
+
+        if (!kcache.mods[mod_id].nr_syms) {
+            kcache.mods[mod_id].first_sym = nr_syms;
+        }
+        kcache.mods[mod_id].nr_syms++;
+        kcache_index_insert(index, kcache.index_mask, nr_syms++);
+    }
+
+    kvfree(mod_ids);
+    kvfree(kcache.index);
+    kcache.index = index;
+    kcache.nr_syms = nr_syms;
+    kcache.strs_len = strs_len;
+    kcache.nr_mods = nr_mods;
+    kcache.dead_syms = 0;
+    kcache.addrs_stale = true;
+
+    return 0;
+}
+
+static int kcache_ready(void)
+{
+    if (kcache.built && kcache.dead_syms > kcache.nr_syms / 2
+        && kcache_compact()) {
+        kcache_free();
+    }
+
+    if (!kcache.built) {
+        return kcache_build();
+    }
+
+    return 0;
+}
+
+bool klookup_cache_enabled(void)
+{
+    return READ_ONCE(kcache.enabled);
+}
+
+int klookup_cache_lookup(struct ksym_query *q)
+{
+    u32 slot;
+    int ret;
+
+    q->addr = 0;
+
+    mutex_lock(&kcache_lock);
+
+    ret = kcache_ready();
+    if (ret) {
+        goto out_unlock;
+    }
+
+    ret = -ENODATA;
+    slot = kcache_hash(q->name) & kcache.index_mask;
+    for (; kcache.index[slot]; slot = (slot + 1) & kcache.index_mask) {
+        const struct kcache_sym *sym = &kcache.syms[kcache.index[slot] - 1];
+        const struct kcache_mod *mod = &kcache.mods[sym->mod_id];
+
+        if (strcmp(kcache.strs + sym->name_off, q->name)
+            || mod->state != KCACHE_MOD_LOADED) {
+            continue;
+        }
+
+        if ((sym->mod_id && q->ignore_mods
+             && is_ignored_mod(mod->name, strlen(mod->name), q->ignore_mods))
+            || is_ignored_type(sym->type, q->ignore_types)) {
+            continue;
+        }
+
+        q->addr = sym->addr;
+        ret = 0;
+        break;
+    }
+
+out_unlock:
+    mutex_unlock(&kcache_lock);
+    q->error = ret;
+
+    return ret;
+}
+
+static int kcache_addr_cmp(const void *a, const void *b)
+{
+    const struct kcache_addr *x = a, *y = b;
+
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    /* aliases: the first one in kallsyms order wins */
+    return x->sym < y->sym ? -1 : x->sym > y->sym;
+}
+
+static int kcache_addr_live(const struct kcache_sym *sym)
+{
+    /* absolute symbols are not code or data anyone calls through */
+    return kcache.mods[sym->mod_id].state == KCACHE_MOD_LOADED
+           && sym->type != 'a' && sym->type != 'A';
+}
+
+static int kcache_addrs_build(void)
+{
+    struct kcache_addr *addrs;
+    u32 nr = 0, out = 0;
+
+    for (u32 i = 0; i < kcache.nr_syms; i++) {
+        nr += kcache_addr_live(&kcache.syms[i]);
+    }
+
+    addrs = kvmalloc_array(max(nr, 1U), sizeof(*addrs), GFP_KERNEL);
+    if (!addrs) {
+        return -ENOMEM;
+    }
+
+    for (u32 i = 0; i < kcache.nr_syms; i++) {
+        if (kcache_addr_live(&kcache.syms[i])) {
+            addrs[out].addr = kcache.syms[i].addr;
+            addrs[out++].sym = i;
+        }
+    }
+    sort(addrs, nr, sizeof(*addrs), kcache_addr_cmp, NULL);
+
+    /* drop aliases, a symbol ends where the next one in its module starts */
+    out = 0;
+    for (u32 i = 0; i < nr; i++) {
+        if (out && addrs[out - 1].addr == addrs[i].addr) {
+            continue;
+        }
+        addrs[out++] = addrs[i];
+    }
+    for (u32 i = 0; i < out; i++) {
+        const struct kcache_addr *next = i + 1 < out ? &addrs[i + 1] : NULL;
+
+        addrs[i].size = 0;
+        if (next && kcache.syms[next->sym].mod_id
+                    == kcache.syms[addrs[i].sym].mod_id
+            && next->addr - addrs[i].addr <= U32_MAX) {
+            addrs[i].size = next->addr - addrs[i].addr;
+        }
+    }
+
+    kvfree(kcache.addrs);
+    kcache.addrs = addrs;
+    kcache.nr_addrs = out;
+    kcache.addrs_stale = false;
+
+    return 0;
+}
+
+int klookup_addr_to_sym(unsigned long addr, struct klookup_sym *res)
+{
+    const struct kcache_addr *hit;
+    const struct kcache_sym *sym;
+    u32 lo = 0, hi;
+    int ret;
+
+    if (!klookup_cache_enabled()) {
+        return -ENOSYS;
+    }
+
+    mutex_lock(&kcache_lock);
+
+    ret = kcache_ready();
+    if (!ret && kcache.addrs_stale) {
+        ret = kcache_addrs_build();
+    }
+    if (ret) {
+        goto out_unlock;
+    }
+
+    /* the last symbol starting at or below addr */
+    hi = kcache.nr_addrs;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+
+        if (kcache.addrs[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    ret = -ENODATA;
+    if (!lo) {
+        goto out_unlock;
+    }
+    hit = &kcache.addrs[lo - 1];
+    if (addr - hit->addr >= max(hit->size, 1U)) {
+        goto out_unlock;
+    }
+
+    sym = &kcache.syms[hit->sym];
+    res->addr = hit->addr;
+    res->size = hit->size;
+    res->offset = addr - hit->addr;
+    res->type = sym->type;
+    strscpy(res->name, kcache.strs + sym->name_off, sizeof(res->name));
+    strscpy(res->module, kcache.mods[sym->mod_id].name, sizeof(res->module));
+    ret = 0;
+
+out_unlock:
+    mutex_unlock(&kcache_lock);
+
+    return ret;
+}
+
+/* '*' matches any run, '?' any one character */
+static bool kcache_glob(const char *pat, const char *str)
+{
+    const char *star = NULL, *retry = NULL;
+
+    while (*str) {
+        if (*pat == '*') {
+            star = ++pat;
+            retry = str;
+        } else if (*pat == '?' || *pat == *str) {
+            pat++;
+            str++;
+        } else if (star) {
+            pat = star;
+            str = ++retry;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pat == '*') {
+        pat++;
+    }
+    return !*pat;
+}
+
+struct kcache_enum {
+    const char *pattern;
+    size_t prefix_len;      /* literal characters before the first wildcard */
+    const char *types;
+    klookup_enum_fn fn;
+    void *data;
+};
+
+static int kcache_enum_range(const struct kcache_enum *e, u32 first, u32 nr)
+{
+    for (u32 i = first; i < first + nr; i++) {
+        const struct kcache_sym *sym = &kcache.syms[i];
+        const struct kcache_mod *mod = &kcache.mods[sym->mod_id];
+        const char *name = kcache.strs + sym->name_off;
+        int ret;
+
+        /* most names already differ in the literal prefix */
+        if (strncmp(name, e->pattern, e->prefix_len)
+            || !kcache_glob(e->pattern + e->prefix_len, name + e->prefix_len)) {
+            continue;
+        }
+
+        if (mod->state != KCACHE_MOD_LOADED
+            || (e->types && !strchr(e->types, sym->type))) {
+            continue;
+        }
+
+        ret = e->fn(name, sym->addr, sym->type, mod->name, e->data);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int klookup_enum_symbols(const char *pattern, const char *module,
+                         const char *types, klookup_enum_fn fn, void *data)
+{
+    struct kcache_enum e = {
+        .pattern = pattern,
+        .prefix_len = strcspn(pattern, "*?"),
+        .types = types,
+        .fn = fn,
+        .data = data,
+    };
+    int ret;
+
+    if (!klookup_cache_enabled()) {
+        return -ENOSYS;
+    }
+
+    mutex_lock(&kcache_lock);
+
+    ret = kcache_ready();
+    if (ret) {
+        goto out_unlock;
+    }
+
+    if (!module) {
+        ret = kcache_enum_range(&e, 0, kcache.nr_syms);
+        goto out_unlock;
+    }
+
+    /* a reloaded module has a dead slot and a live one, walk just the live */
+    for (u32 i = 1; i < kcache.nr_mods && !ret; i++) {
+        const struct kcache_mod *mod = &kcache.mods[i];
+
+        if (mod->state == KCACHE_MOD_LOADED && !strcmp(mod->name, module)) {
+            ret = kcache_enum_range(&e, mod->first_sym, mod->nr_syms);
+        }
+    }
+
+out_unlock:
+    mutex_unlock(&kcache_lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+#if KCACHE_MOD_SYMTAB
+/*
+ * Takes the symbols /proc/kallsyms will list for mod once it is live. At
+ * MODULE_STATE_LIVE mod->kallsyms still points at the load-time table,
+ * init symbols included, and module_kallsyms_on_each_symbol() walks that
+ * one without types; core_kallsyms is the table it switches to after init.
+ */
+static int kcache_add_mod_syms(struct module *mod, u16 mod_id)
+{
+    const struct mod_kallsyms *kallsyms = &mod->core_kallsyms;
+
+    for (unsigned int i = 0; i < kallsyms->num_symtab; i++) {
+        const Elf_Sym *sym = &kallsyms->symtab[i];
+        const char *name = kallsyms->strtab + sym->st_name;
+        int ret;
+
+        if (!*name) {
+            continue;
+        }
+
+        /* types moved from st_info to their own array in 5.2 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+        ret = kcache_add_sym(name, strlen(name), sym->st_value,
+                             kallsyms->typetab[i], mod_id);
+#else
+        ret = kcache_add_sym(name, strlen(name), sym->st_value,
+                             sym->st_info, mod_id);
+#endif
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+#else
+static int kcache_add_mod_syms(struct module *mod, u16 mod_id)
+{
+    return -EOPNOTSUPP;
+}
+#endif
+
+static int kcache_module_notify(struct notifier_block *nb,
+                                unsigned long action, void *data)
+{
+    struct module *mod = data;
+
+    if (action != MODULE_STATE_LIVE && action != MODULE_STATE_GOING) {
+        return NOTIFY_DONE;
+    }
+
+    mutex_lock(&kcache_lock);
+    if (!kcache.built) {
+        goto out_unlock;
+    }
+
+    for (u32 i = 1; i < kcache.nr_mods; i++) {
+        struct kcache_mod *cached = &kcache.mods[i];
+
+        if (cached->state == KCACHE_MOD_DEAD || strcmp(cached->name, mod->name)) {
+            continue;
+        }
+
+        cached->state = KCACHE_MOD_DEAD;
+        kcache.dead_syms += cached->nr_syms;
+        kcache.addrs_stale = true;
+    }
+
+    if (action == MODULE_STATE_LIVE) {
+        int mod_id;
+
+        /* reloads leave dead slots behind, reclaim them before giving up */
+        if (kcache.nr_mods >= KCACHE_MAX_MODS) {
+            kcache_compact();
+        }
+
+        mod_id = kcache_add_mod(mod->name, strlen(mod->name),
+                                KCACHE_MOD_LOADED);
+
+        /* out of slots or memory, or no usable symtab: rebuild on next use */
+        if (mod_id < 0 || kcache_add_mod_syms(mod, mod_id)) {
+            kcache_free();
+        } else {
+            kcache.addrs_stale = true;
+        }
+    }
+
+out_unlock:
+    mutex_unlock(&kcache_lock);
+
+    return NOTIFY_OK;
+}
+
+/* ahead of the users' notifiers, so they look up the new module's symbols */
+static struct notifier_block kcache_module_nb = {
+    .notifier_call = kcache_module_notify,
+    .priority = 1,
+};
+
+int klookup_cache_init(void)
+{
+    int ret;
+
+    ret = register_module_notifier(&kcache_module_nb);
+    if (ret) {
+        printk(KERN_ERR
+               "Module notifier registration failed. Error number: %d\n", ret);
+        return ret;
+    }
+
+    WRITE_ONCE(kcache.enabled, true);
+    return 0;
+}
+
+void klookup_cache_exit(void)
+{
+    WRITE_ONCE(kcache.enabled, false);
+    unregister_module_notifier(&kcache_module_nb);
+
+    mutex_lock(&kcache_lock);
+    kcache_free();
+    mutex_unlock(&kcache_lock);
+}
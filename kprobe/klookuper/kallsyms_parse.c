@@ -0,0 +1,147 @@
+/**
+ * Streaming `/proc/kallsyms` parser. Lines are found a word at a time and
+ * split in place, so a full table is parsed without a single allocation
+ * or copy, and the address is only decoded for the lines a caller wants.
+ *
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+*/
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#else
+#include <errno.h>
+#endif
+
+#include "kallsyms_parse.h"
+
+#define ONE_BYTES  0x0101010101010101ULL
+#define HIGH_BYTES 0x8080808080808080ULL
+
+/* first ch in [p, end), or end */
+static const char *find_byte(const char *p, const char *end, unsigned char ch)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    unsigned long long pattern = ONE_BYTES * ch;
+
+    /* a zero byte in word ^ pattern is a match, the lowest one comes first */
+    while (end - p >= 8) {
+        unsigned long long word;
+        unsigned long long hit;
+
+        memcpy(&word, p, sizeof(word));
+        word ^= pattern;
+        hit = (word - ONE_BYTES) & ~word & HIGH_BYTES;
+        if (hit) {
+            return p + (__builtin_ctzll(hit) >> 3);
+        }
+        p += 8;
+    }
+#endif
+
+    while (p < end && (unsigned char)*p != ch) {
+        p++;
+    }
+
+    return p;
+}
+
+/* "<addr> <type> <name>[\t[<module>]]" */
+static int parse_line(const char *p, const char *end, struct ksym_line *line)
+{
+    const char *tab;
+
+    line->addr = p;
+    p = find_byte(p, end, ' ');
+    if (p == end || p == line->addr) {
+        return -EINVAL;
+    }
+    line->addr_len = p - line->addr;
+    p++;
+
+    /* sometimes the type might be missing */
+    if (end - p >= 2 && p[1] == ' ') {
+        line->type = p[0];
+        p += 2;
+    } else {
+        line->type = '\0';
+    }
+
+    tab = find_byte(p, end, '\t');
+    line->name = p;
+    line->name_len = tab - p;
+    if (!line->name_len) {
+        return -EINVAL;
+    }
+
+    line->mod = NULL;
+    line->mod_len = 0;
+    if (tab != end) {
+        p = tab + 1;
+        if (end - p > 2 && p[0] == '[' && end[-1] == ']') {
+            p++;
+            end--;
+        }
+        line->mod = p;
+        line->mod_len = end - p;
+    }
+
+    return 0;
+}
+
+size_t kallsyms_parse(const char *buf, size_t len, int eof,
+                      ksym_line_fn fn, void *data, int *stop)
+{
+    const char *p = buf, *end = buf + len;
+    struct ksym_line line;
+
+    *stop = 0;
+    while (p < end) {
+        const char *nl = find_byte(p, end, '\n');
+
+        /* carried over to the next read */
+        if (nl == end && !eof) {
+            break;
+        }
+
+        if (nl != p) {
+            *stop = parse_line(p, nl, &line);
+            if (!*stop) {
+                *stop = fn(&line, data);
+            }
+        }
+
+        p = nl == end ? end : nl + 1;
+        if (*stop) {
+            break;
+        }
+    }
+
+    return p - buf;
+}
+
+int kallsyms_parse_addr(const struct ksym_line *line, unsigned long *addr)
+{
+    unsigned long res = 0;
+
+    if (line->addr_len > 2 * sizeof(res)) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < line->addr_len; i++) {
+        char ch = line->addr[i];
+
+        res <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            res |= ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            res |= ch - 'a' + 0xa;
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    *addr = res;
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef KLOOKUP_KALLSYMS_PARSE_H
+#define KLOOKUP_KALLSYMS_PARSE_H
+
+/*
+ * Streaming parser for the `/proc/kallsyms` text. It has no kernel
+ * dependencies so the userspace bench can build the very same code.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#else
+#include <stddef.h>
+#include <string.h>
+#endif
+
+/* one line, split in place; nothing is copied or NUL terminated */
+struct ksym_line {
+    const char *addr;
+    size_t addr_len;
+    const char *name;
+    size_t name_len;
+    const char *mod;        /* without the brackets, NULL for vmlinux */
+    size_t mod_len;
+    char type;
+};
+
+/* called per line, a non-zero return ends the parse and is passed back */
+typedef int (*ksym_line_fn)(const struct ksym_line *line, void *data);
+
+/*
+ * Feeds every complete line of buf[0, len) to fn and returns how many
+ * bytes that consumed. An unfinished last line is left for the caller to
+ * carry into the next call, unless eof says no more data is coming. *stop
+ * gets fn's non-zero return, or -EINVAL for a malformed line.
+ */
+extern size_t kallsyms_parse(const char *buf, size_t len, int eof,
+                             ksym_line_fn fn, void *data, int *stop);
+
+/* decodes the hex address, only worth it once the name matched */
+extern int kallsyms_parse_addr(const struct ksym_line *line,
+                               unsigned long *addr);
+
+static inline int ksym_line_name_is(const struct ksym_line *line,
+                                    const char *name, size_t len)
+{
+    return line->name_len == len && !memcmp(line->name, name, len);
+}
+
+#endif // KLOOKUP_KALLSYMS_PARSE_H
@@ -2,6 +2,12 @@
  * Tools for reading `/proc/kallsyms` to get the address of an expected symbol
  * that may not exported for kernel module developer to use, but could be found
  * in the `/proc/kallsyms`.
+ *
+ * Two backends: the native one asks the kernel's own symbol table through
+ * kallsyms_lookup_name (found with a kprobe, it is no longer exported), the
+ * procfs one parses the `/proc/kallsyms` text. The native one cannot see the
+ * symbol type, so lookups filtering on it, or kernels where it is missing,
+ * fall back to procfs.
  * 
  * 
  * This work is licensed under the terms of the GNU GPL, version 2 or later.
@@ -15,21 +21,20 @@
 #include <linux/types.h>
 #include <linux/mman.h>
 #include <linux/pid_namespace.h>
+#include <linux/kprobes.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 
 #include "lookuper.h"
+#include "lookuper_internal.h"
+#include "kallsyms_parse.h"
 
-static const char common_blank_seperators[] = {
-    ' ', '\t', '\n', '\b'
-};
-
-static const int
-common_blank_seperator_nr = sizeof(common_blank_seperators) / sizeof(char);
-
-static __always_inline
-int is_seperator(const char ch,const char *seperators,const size_t seperator_nr)
+int is_ignored_mod(const char *modname, size_t len, const char **ignore_mods)
 {
-    for (size_t i = 0; i < seperator_nr; i++) {
-        if (ch == seperators[i]) {
+    for (const char **mod = ignore_mods; *mod; mod++) {
+        if (!strncmp(*mod, modname, len) && (*mod)[len] == '\0') {
             return 1;
         }
     }
@@ -37,311 +42,125 @@ int is_seperator(const char ch,const char *seperators,const size_t seperator_nr)
     return 0;
 }
 
-static size_t get_next_token_in_str(const char *src,
-                                    char *res,
-                                    size_t *ppos,
-                                    size_t end_pos,
-                                    const char *seperators,
-                                    int seperator_nr)
+int is_ignored_type(char type, const char *ignore_types)
 {
-    size_t len = 0;
-
-    /* default seperators */
-    if ((!seperators) || seperator_nr == -1) {
-        seperators = common_blank_seperators;
-        seperator_nr = common_blank_seperator_nr;
-    }
-
-    /* read a token */
-    while (!is_seperator(src[*ppos], seperators, seperator_nr)) {
-        if ((*ppos) >= end_pos) {
-            break;
+    if (ignore_types) {
+        for (const char *ptyp = ignore_types; *ptyp; ptyp++) {
+            if (type == *ptyp) {
+                return 1;
+            }
         }
-
-        res[len++] = src[(*ppos)++];
     }
 
-    res[len] ='\0';
-
-    /* clear redundant seperators */
-    while ((*ppos)<end_pos && is_seperator(src[*ppos],seperators,seperator_nr)){
-        (*ppos)++;
-    }
-
-    return len;
+    return 0;
 }
 
-static int get_next_kallsyms_info(char *ksym_buf,
-                                  size_t ksym_buf_len,
-                                  struct ksym_info *res)
+/* the name already matched, do the filters of the query let it through */
+static int query_accepts(const struct ksym_query *q,
+                         const struct ksym_line *line)
 {
-    char *buf;
-    size_t len, pos = 0;
-    enum {
-        KADDR = 0,
-        KTYPE,
-        KNAME,
-        KMODNAME,
-        KUNKNOWN,
-    } status;
-    int ret = 0;
-
-    buf = kmalloc(ksym_buf_len, GFP_KERNEL);
-    if (!buf) {
-        return -ENOMEM;
-    }
-
-    for (status = KADDR; ; status++) {
-        len = get_next_token_in_str(ksym_buf, buf, &pos, ksym_buf_len, NULL,-1);
-        if (len == 0) {
-            break;
-        }
-
-        switch (status) {
-        case KADDR:
-            if (unlikely(len != 16)) {
-                for (size_t i = 0; i < len; i++) {
-                    if ((buf[i] < '0' || buf[i] > '9')
-                        && (buf[i] < 'a' || buf[i] > 'f')) {
-                        printk(KERN_ERR
-                               "Got unknown char [%c] in ksyms addr\n", buf[i]);
-                        ret = -EINVAL;
-                        goto out;
-                    }
-                }
-            }
-
-            res->addr = 0;
-            for (int i = 0; i < len; i++) {
-                res->addr <<= 4;
-                if (buf[i] >= '0' && buf[i] <= '9') {
-                    res->addr |= buf[i] - '0';
-                } else if (buf[i] >= 'a' && buf[i] <= 'f') {
-                    res->addr |= buf[i] - 'a' + 0xa;
-                } else {
-                    printk(KERN_ERR
-                           "Got unknown char [%c] in ksyms addr", buf[i]);
-                    ret = -EINVAL;
-                    goto out;
-                }
-            }
-
-            break;
-
-        case KTYPE:
-            /* sometimes it might be missing, fall through */
-            if (strlen(buf) == 1) {
-                res->type = buf[0];
-                continue;
-            }
-
-            fallthrough;
-
-        case KNAME:
-            strcpy(res->name, buf);
-            break;
-
-        case KMODNAME:
-            strcpy(res->module, buf);
-            break;
-
-        default:
-            printk(KERN_ERR
-                   "Got unhandlable token [%s] in kallsyms line\n", buf);
-            ret = -EINVAL;
-            goto out;
-            break;
-        }
+    /* we may have some symbols in other modules we don't want */
+    if (line->mod && q->ignore_mods
+        && is_ignored_mod(line->mod, line->mod_len, q->ignore_mods)) {
+        return 0;
     }
 
-out:
-    kfree(buf);
-
-    return ret;
+    return !is_ignored_type(line->type, q->ignore_types);
 }
 
-static ssize_t get_kallsyms_info(struct file *ksym_fp,
-                                 const char *target_name,
-                                 struct ksym_info *res,
-                                 const char **ignore_mods,
-                                 const char *ignore_types)
+/*
+ * seq_file hands out whole lines per read, but only as many as fit, so a
+ * big read buffer means few reads. A line left unfinished at the end of
+ * the buffer is moved to its front and completed by the next read.
+ */
+#define KSYM_READ_SIZE (64 * 1024)
+
+static int get_kallsyms_info(struct file *ksym_fp, ksym_line_fn match,
+                             void *data)
 {
-    char *ksym_buf, *per_ksym_buf;
-    size_t ksym_buf_len, per_ksym_len, per_ksym_pos;
+    char *ksym_buf;
+    size_t carry = 0, used;
     ssize_t read_len;
-    struct ksym_info *curr_info;
-    ssize_t ret = 0;
-    int found = 0;
     loff_t fpos;
-    static const char line_seperator[] = { '\n' };
-    int parse_ret;
+    int ret = 0;
     char __user *ubuf;
 
-    if (!ksym_fp || !res) {
-        ret = -EFAULT;
-        goto out_ret;
-    }
-
     ubuf = (void*) vm_mmap(NULL,
                            0,
-                           PAGE_SIZE,
+                           KSYM_READ_SIZE,
                            PROT_READ | PROT_WRITE,
                            MAP_ANONYMOUS | MAP_PRIVATE,
                            0);
     if (IS_ERR(ubuf)) {
-        ret = PTR_ERR(ubuf);
-        goto out_ret;
-    }
-
-    curr_info = kmalloc(sizeof(*curr_info), GFP_KERNEL);
-    if (!curr_info) {
-        ret = -ENOMEM;
-        goto out_free_ubuf;
+        return PTR_ERR(ubuf);
     }
 
-    per_ksym_buf = kmalloc(0x200, GFP_KERNEL);
-    if (!per_ksym_buf) {
-        ret = -ENOMEM;
-        goto out_free_buf;
-    }
-
-    ksym_buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    ksym_buf = kvmalloc(KSYM_READ_SIZE, GFP_KERNEL);
     if (!ksym_buf) {
         ret = -ENOMEM;
-        goto out_free_info;
+        goto out_free_ubuf;
     }
 
     for (;;) {
         fpos = ksym_fp->f_pos;
-        read_len = ksym_fp->f_op->read(ksym_fp, ubuf, PAGE_SIZE, &fpos);
+        read_len = ksym_fp->f_op->read(ksym_fp, ubuf, KSYM_READ_SIZE - carry,
+                                       &fpos);
         if (read_len < 0) {
             ret = read_len;
-            goto out_free_linebuf;
-        }
-
-        ksym_fp->f_pos = fpos;
-        if (read_len == 0) {
             break;
         }
-        ksym_buf_len = read_len;
+        ksym_fp->f_pos = fpos;
 
-        if (!ksym_buf || !ubuf) {
+        if (copy_from_user(ksym_buf + carry, ubuf, read_len)) {
             ret = -EFAULT;
-            goto out_free_linebuf;
+            break;
         }
 
-        if (copy_from_user(ksym_buf, ubuf, ksym_buf_len)) {
-            ret = -EFAULT;
-            goto out_free_linebuf;
+        used = kallsyms_parse(ksym_buf, carry + read_len, read_len == 0,
+                              match, data, &ret);
+        if (ret || read_len == 0) {
+            break;
         }
 
-        per_ksym_pos = 0;
-        for (;;) {
-        token_again:
-            per_ksym_len = get_next_token_in_str(ksym_buf,
-                                                  per_ksym_buf,
-                                                  &per_ksym_pos,
-                                                  ksym_buf_len,
-                                                  line_seperator,
-                                                  1);
-            if (per_ksym_len == 0) {
-                break;
-            }
-
-            memset(res, 0, sizeof(*res));
-            parse_ret = get_next_kallsyms_info(per_ksym_buf,per_ksym_len,res);
-            if (parse_ret) {
-                ret = parse_ret;
-                goto out_free_linebuf;
-            }
-
-            if (!strcmp(res->name, target_name)) {
-                /* we may have some symbols in other modules we don't want */
-                if (strlen(res->module) != 0 && ignore_mods) {
-                    for (const char **mod = ignore_mods; *mod; mod++) {
-                        if (!strcmp(*mod, res->module)) {
-                            goto token_again;
-                        }
-                    }
-                }
-
-                if (ignore_types) {
-                    for (const char *ptyp = ignore_types; *ptyp; ptyp++) {
-                        if (res->type == *ptyp) {
-                            goto token_again;
-                        }
-                    }
-                }
-
-                found = 1;
-                goto out_loop;
-            }
+        carry = carry + read_len - used;
+        if (carry == KSYM_READ_SIZE) {
+            /* no line is anywhere near this long */
+            ret = -EINVAL;
+            break;
         }
+        memmove(ksym_buf, ksym_buf + used, carry);
     }
 
-out_loop:
-    if (!found) {
-        ret = -ENODATA;
-    }
-
-out_free_linebuf:
-    kfree(per_ksym_buf);
-
-out_free_buf:
-    kfree(ksym_buf);
-
-out_free_info:
-    kfree(curr_info);
+    kvfree(ksym_buf);
 
 out_free_ubuf:
-    vm_munmap((unsigned long) ubuf, PAGE_SIZE);
+    vm_munmap((unsigned long) ubuf, KSYM_READ_SIZE);
 
-out_ret:
-
-    return ret;
+    /* a positive return only means the match ended the scan */
+    return ret < 0 ? ret : 0;
 }
 
-static int __kallsyms_addr_lookup(const char *name,
-                                  size_t *res,
-                                  const char **ignore_mods,
-                                  const char *ignore_types)
+static int __kallsyms_scan(ksym_line_fn match, void *data)
 {
-    int error = 0;
     struct file *ksym_fp;
-    struct ksym_info *info;
+    int error;
 
     ksym_fp = filp_open("/proc/kallsyms", O_RDONLY, 0);
-
     if (IS_ERR(ksym_fp)) {
-        error = PTR_ERR(ksym_fp);
-        goto out_ret;
-    }
-
-    info = kmalloc(sizeof(*info), GFP_KERNEL);
-    if (!info) {
-        error = -ENOMEM;
-        goto out_free_file;
+        return PTR_ERR(ksym_fp);
     }
 
-    error = get_kallsyms_info(ksym_fp, name, info, ignore_mods, ignore_types);
+    error = get_kallsyms_info(ksym_fp, match, data);
     if (error) {
-        goto out_free_info;
+        printk(KERN_ERR "Failed to parse /proc/kallsyms: %d\n", error);
     }
 
-    *res = info->addr;
-
-out_free_info:
-    kfree(info);
-out_free_file:
     filp_close(ksym_fp, NULL);
-out_ret:
     return error;
 }
 
-int kallsyms_addr_lookup(const char *name,
-                         size_t *res,
-                         const char **ignore_mods,
-                         const char *ignore_types)
+/* /proc/kallsyms only shows addresses to a privileged reader */
+int kallsyms_scan(ksym_line_fn match, void *data)
 {
     struct cred *old, *root;
     int ret;
@@ -363,7 +182,7 @@ int kallsyms_addr_lookup(const char *name,
 
     commit_creds(root);
 
-    ret = __kallsyms_addr_lookup(name, res, ignore_mods, ignore_types);
+    ret = __kallsyms_scan(match, data);
 
     commit_creds(old);
 
@@ -371,3 +190,356 @@ int kallsyms_addr_lookup(const char *name,
 
     return ret;
 }
+
+/*
+ * Pending queries of a batch, hashed by name so each kallsyms line costs
+ * one probe sequence however many names are wanted. Slots hold the query
+ * index + 1, 0 is empty; equal names with other filters share a run.
+ */
+struct ksym_batch {
+    struct ksym_query *queries;
+    unsigned int *slots;
+    unsigned int mask;
+    size_t pending;
+    u64 name_lens;          /* bit len % 64 set for every pending name */
+};
+
+static int batch_match(const struct ksym_line *line, void *data)
+{
+    struct ksym_batch *batch = data;
+    unsigned long addr;
+    unsigned int i;
+
+    /* most lines are rejected on the length of their name alone */
+    if (!(batch->name_lens & BIT_ULL(line->name_len % 64))) {
+        return 0;
+    }
+
+    i = jhash(line->name, line->name_len, 0) & batch->mask;
+    for (; batch->slots[i]; i = (i + 1) & batch->mask) {
+        struct ksym_query *q = &batch->queries[batch->slots[i] - 1];
+
+        if (q->error != -EAGAIN
+            || !ksym_line_name_is(line, q->name, strlen(q->name))
+            || !query_accepts(q, line)) {
+            continue;
+        }
+
+        if (kallsyms_parse_addr(line, &addr)) {
+            return -EINVAL;
+        }
+
+        q->addr = addr;
+        q->error = 0;
+        batch->pending--;
+    }
+
+    return batch->pending == 0;
+}
+
+/* resolves, in one pass, every query whose error is -EAGAIN */
+static int procfs_lookup_batch(struct ksym_query *queries, size_t nr)
+{
+    struct ksym_batch batch = { .queries = queries };
+    unsigned int size;
+    int ret;
+
+    for (size_t i = 0; i < nr; i++) {
+        if (queries[i].error == -EAGAIN) {
+            batch.pending++;
+        }
+    }
+    if (!batch.pending) {
+        return 0;
+    }
+
+    /* at most half full, probe runs stay short */
+    size = roundup_pow_of_two(batch.pending * 2);
+    batch.slots = kcalloc(size, sizeof(*batch.slots), GFP_KERNEL);
+    if (!batch.slots) {
+        return -ENOMEM;
+    }
+    batch.mask = size - 1;
+
+    for (size_t i = 0; i < nr; i++) {
+        unsigned int slot;
+
+        if (queries[i].error != -EAGAIN) {
+            continue;
+        }
+
+        batch.name_lens |= BIT_ULL(strlen(queries[i].name) % 64);
+        slot = jhash(queries[i].name, strlen(queries[i].name), 0) & batch.mask;
+        while (batch.slots[slot]) {
+            slot = (slot + 1) & batch.mask;
+        }
+        batch.slots[slot] = i + 1;
+    }
+
+    ret = kallsyms_scan(batch_match, &batch);
+
+    for (size_t i = 0; i < nr; i++) {
+        if (queries[i].error == -EAGAIN) {
+            queries[i].error = ret ? ret : -ENODATA;
+        }
+    }
+
+    kfree(batch.slots);
+    return ret;
+}
+
+static int procfs_addr_lookup(const char *name,
+                              size_t *res,
+                              const char **ignore_mods,
+                              const char *ignore_types)
+{
+    struct ksym_query q = {
+        .name = name,
+        .ignore_mods = ignore_mods,
+        .ignore_types = ignore_types,
+        .error = -EAGAIN,
+    };
+
+    procfs_lookup_batch(&q, 1);
+    if (!q.error) {
+        *res = q.addr;
+    }
+
+    return q.error;
+}
+
+typedef unsigned long (*kallsyms_lookup_name_t)(const char *name);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+typedef int (*ksym_each_fn_t)(void *data, const char *name, unsigned long addr);
+typedef int (*module_kallsyms_on_each_symbol_t)(const char *modname,
+                                                ksym_each_fn_t fn,
+                                                void *data);
+#else
+typedef int (*ksym_each_fn_t)(void *data, const char *name,
+                              struct module *mod, unsigned long addr);
+typedef int (*module_kallsyms_on_each_symbol_t)(ksym_each_fn_t fn, void *data);
+#endif
+
+static kallsyms_lookup_name_t native_lookup_name;
+static module_kallsyms_on_each_symbol_t native_module_each;
+
+/* kallsyms_lookup_name is unexported since 5.7, but kprobes still find it */
+static int native_init(void)
+{
+    struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+    kallsyms_lookup_name_t lookup_name;
+    int ret;
+
+    if (READ_ONCE(native_lookup_name)) {
+        return 0;
+    }
+
+    ret = register_kprobe(&kp);
+    if (ret < 0) {
+        printk(KERN_ERR
+               "Kprobe registration for kallsyms_lookup_name failed. "
+               "Error number: %d\n", ret);
+        return -ENOSYS;
+    }
+    lookup_name = (kallsyms_lookup_name_t) kp.addr;
+    unregister_kprobe(&kp);
+
+    /* only needed when the first hit is in an ignored module, may be 0 */
+    WRITE_ONCE(native_module_each, (module_kallsyms_on_each_symbol_t)
+               lookup_name("module_kallsyms_on_each_symbol"));
+    WRITE_ONCE(native_lookup_name, lookup_name);
+
+    return 0;
+}
+
+static int is_ignored_addr(unsigned long addr, const char **ignore_mods)
+{
+    struct module *mod;
+    int ret = 0;
+
+    preempt_disable();
+    mod = __module_address(addr);
+    if (mod) {
+        ret = is_ignored_mod(mod->name, strlen(mod->name), ignore_mods);
+    }
+    preempt_enable();
+
+    return ret;
+}
+
+struct native_walk {
+    const char *name;
+    const char **ignore_mods;
+    unsigned long addr;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static int native_walk_symbol(void *data, const char *name, unsigned long addr)
+{
+    struct native_walk *walk = data;
+
+    if (strcmp(name, walk->name) || is_ignored_addr(addr, walk->ignore_mods)) {
+        return 0;
+    }
+#else
+static int native_walk_symbol(void *data, const char *name,
+                              struct module *mod, unsigned long addr)
+{
+    struct native_walk *walk = data;
+
+    if (strcmp(name, walk->name)
+        || (mod && is_ignored_mod(mod->name, strlen(mod->name),
+                                walk->ignore_mods))) {
+        return 0;
+    }
+#endif
+
+    walk->addr = addr;
+    return 1;
+}
+
+static int native_addr_lookup(const char *name,
+                              size_t *res,
+                              const char **ignore_mods)
+{
+    struct native_walk walk = { .name = name, .ignore_mods = ignore_mods };
+    module_kallsyms_on_each_symbol_t module_each;
+    unsigned long addr;
+    int ret;
+
+    ret = native_init();
+    if (ret) {
+        return ret;
+    }
+
+    /* vmlinux first, then modules in load order, like /proc/kallsyms */
+    addr = native_lookup_name(name);
+    if (!addr) {
+        return -ENODATA;
+    }
+
+    if (!ignore_mods || !is_ignored_addr(addr, ignore_mods)) {
+        *res = addr;
+        return 0;
+    }
+
+    /* the first hit is in an ignored module, look at the other modules */
+    module_each = READ_ONCE(native_module_each);
+    if (!module_each) {
+        return -ENOSYS;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+    module_each(NULL, native_walk_symbol, &walk);
+#else
+    module_each(native_walk_symbol, &walk);
+#endif
+    if (!walk.addr) {
+        return -ENODATA;
+    }
+
+    *res = walk.addr;
+    return 0;
+}
+
+int kallsyms_addr_lookup_backend(const char *name,
+                                 size_t *res,
+                                 const char **ignore_mods,
+                                 const char *ignore_types,
+                                 enum klookup_backend backend)
+{
+    struct ksym_query q = {
+        .name = name,
+        .ignore_mods = ignore_mods,
+        .ignore_types = ignore_types,
+    };
+    int ret;
+
+    switch (backend) {
+    case KLOOKUP_AUTO:
+        if (klookup_cache_enabled()) {
+            ret = klookup_cache_lookup(&q);
+            if (!ret) {
+                *res = q.addr;
+            }
+            return ret;
+        }
+        if (!ignore_types || !*ignore_types) {
+            ret = native_addr_lookup(name, res, ignore_mods);
+            if (ret != -ENOSYS) {
+                return ret;
+            }
+        }
+        return procfs_addr_lookup(name, res, ignore_mods, ignore_types);
+
+    case KLOOKUP_NATIVE:
+        if (ignore_types && *ignore_types) {
+            return -EOPNOTSUPP;
+        }
+        return native_addr_lookup(name, res, ignore_mods);
+
+    case KLOOKUP_PROCFS:
+        return procfs_addr_lookup(name, res, ignore_mods, ignore_types);
+
+    case KLOOKUP_CACHE:
+        if (!klookup_cache_enabled()) {
+            return -ENOSYS;
+        }
+        ret = klookup_cache_lookup(&q);
+        if (!ret) {
+            *res = q.addr;
+        }
+        return ret;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+int kallsyms_addr_lookup(const char *name,
+                         size_t *res,
+                         const char **ignore_mods,
+                         const char *ignore_types)
+{
+    return kallsyms_addr_lookup_backend(name, res, ignore_mods, ignore_types,
+                                        KLOOKUP_AUTO);
+}
+
+static int native_usable(const struct ksym_query *q)
+{
+    return !q->ignore_types || !*q->ignore_types;
+}
+
+int kallsyms_addr_lookup_batch(struct ksym_query *queries, size_t nr)
+{
+    int ret = 0;
+
+    /* native lookups are cheap one by one, the rest share one procfs pass */
+    for (size_t i = 0; i < nr; i++) {
+        queries[i].addr = 0;
+        queries[i].error = -EAGAIN;
+        if (klookup_cache_enabled()) {
+            queries[i].error = klookup_cache_lookup(&queries[i]);
+        } else if (native_usable(&queries[i])) {
+            ret = native_addr_lookup(queries[i].name, &queries[i].addr,
+                                     queries[i].ignore_mods);
+            if (ret != -ENOSYS) {
+                queries[i].error = ret;
+            }
+        }
+    }
+
+    ret = procfs_lookup_batch(queries, nr);
+    if (ret) {
+        return ret;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        if (queries[i].error) {
+            return -ENODATA;
+        }
+    }
+
+    return 0;
+}
@@ -13,9 +13,80 @@ struct ksym_info {
     char module[KALLSYMS_MODNAME_LEN];
 };
 
+enum klookup_backend {
+    KLOOKUP_AUTO,       /* native, procfs when it cannot answer */
+    KLOOKUP_NATIVE,     /* kallsyms_lookup_name, no type filtering */
+    KLOOKUP_PROCFS,     /* parse /proc/kallsyms */
+    KLOOKUP_CACHE,      /* klookup_cache_init() must have been called */
+};
+
+extern int kallsyms_addr_lookup_backend(const char *name,
+                                        size_t *res,
+                                        const char **ignore_mods,
+                                        const char *ignore_types,
+                                        enum klookup_backend backend);
+
 extern int kallsyms_addr_lookup(const char *name,
                                 size_t *res,
                                 const char **ignore_mods,
                                 const char *ignore_types);
 
+/* one name of a batch lookup, addr and error are filled in */
+struct ksym_query {
+    const char *name;
+    const char **ignore_mods;   /* NULL terminated, may be NULL */
+    const char *ignore_types;   /* may be NULL */
+    size_t addr;
+    int error;                  /* 0, -ENODATA when not found */
+};
+
+/*
+ * Resolves every query, with at most one pass over /proc/kallsyms for
+ * those the native backend cannot answer. Returns 0 when all were found,
+ * -ENODATA when some were not (see their error), or the error that made
+ * the pass itself fail.
+ */
+extern int kallsyms_addr_lookup_batch(struct ksym_query *queries, size_t nr);
+
+/*
+ * Symbol cache: the first lookup after init loads the whole table once,
+ * later ones are a hash lookup. Modules loaded later are added on the next
+ * lookup, unloaded ones drop out. Once enabled, KLOOKUP_AUTO and the batch
+ * API go through it.
+ */
+extern int klookup_cache_init(void);
+extern void klookup_cache_exit(void);
+
+/* about 1K, better not on a deep stack */
+struct klookup_sym {
+    unsigned long addr;                 /* where the symbol starts */
+    unsigned long size;                 /* 0 when it could not be told */
+    unsigned long offset;               /* of the looked up address */
+    char type;
+    char name[KALLSYMS_NAME_LEN];
+    char module[KALLSYMS_MODNAME_LEN];  /* empty for vmlinux */
+};
+
+/*
+ * Symbolizes an address through the cache: a binary search over the live
+ * symbols sorted by address. -ENODATA when no symbol covers it, -ENOSYS
+ * without klookup_cache_init().
+ */
+extern int klookup_addr_to_sym(unsigned long addr, struct klookup_sym *res);
+
+/* module is "" for vmlinux; a non-zero return stops the enumeration */
+typedef int (*klookup_enum_fn)(const char *name, unsigned long addr,
+                               char type, const char *module, void *data);
+
+/*
+ * Calls fn for every cached symbol matching a glob pattern ('*', '?'),
+ * in kallsyms order. module limits it to one module's symbols, types to
+ * the given type letters; NULL means any. fn runs under the cache lock,
+ * so it must not call back into klookuper. Returns 0, fn's negative
+ * return, or -ENOSYS without klookup_cache_init().
+ */
+extern int klookup_enum_symbols(const char *pattern, const char *module,
+                                const char *types, klookup_enum_fn fn,
+                                void *data);
+
 #endif // KLOOKUP_LOOKUPER_H
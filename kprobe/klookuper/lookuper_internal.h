@@ -0,0 +1,18 @@
+#ifndef KLOOKUP_LOOKUPER_INTERNAL_H
+#define KLOOKUP_LOOKUPER_INTERNAL_H
+
+#include "lookuper.h"
+#include "kallsyms_parse.h"
+
+/* one pass over /proc/kallsyms with init's credentials */
+extern int kallsyms_scan(ksym_line_fn match, void *data);
+
+extern int is_ignored_mod(const char *modname, size_t len,
+                          const char **ignore_mods);
+extern int is_ignored_type(char type, const char *ignore_types);
+
+extern bool klookup_cache_enabled(void);
+/* fills q->addr, returns 0 or -ENODATA like q->error */
+extern int klookup_cache_lookup(struct ksym_query *q);
+
+#endif // KLOOKUP_LOOKUPER_INTERNAL_H
@@ -10,113 +10,384 @@
 #include<linux/cdev.h>
 #include<linux/kernel.h>
 #include<linux/kprobes.h>
+#include<linux/mutex.h>
+#include<linux/notifier.h>
+#include<linux/debugfs.h>
 #include <linux/kallsyms.h>
 
 #include "klookuper/lookuper.h"
+#include "kprobe_test.h"
 
 MODULE_LICENSE("Dual BSD/GPL");
 //EXPORT_SYMBOL(acm_write_done);
 
+char *target = "cdc_acm";
+module_param(target, charp, 0444);
+MODULE_PARM_DESC(target, "Traced driver module: cdc_acm or my_usb_serial");
+
+/* a printk per hit, outside filtering, sampling and the CPU budget */
+static bool log_hits;
+module_param(log_hits, bool, 0644);
+MODULE_PARM_DESC(log_hits, "Log every probe hit to the kernel log (debugging only)");
 
 static int kprobe_init(void);
 static void kprobe_exit(void);
 
-static struct kprobe kp_open;
-static struct kprobe kp_read;
-static struct kprobe kp_write;
-static struct kprobe kp_close;
-
 static int pre_handler_open(struct kprobe *kp, struct pt_regs *regs)
 {
-  pr_info("cdc_acm: open function interrupt");
+  kt_stack_hit(KT_PROBE_OPEN, kp);
+  if (READ_ONCE(log_hits))
+    pr_info("%s: open function interrupt", target);
   return 0;
 }
 
 static int pre_handler_read(struct kprobe *kp, struct pt_regs *regs)
 {
-  pr_info("cdc_acm: read function interrupt");
+  kt_stack_hit(KT_PROBE_READ, kp);
+  if (READ_ONCE(log_hits))
+    pr_info("%s: read function interrupt", target);
   return 0;
 }
 
 static int pre_handler_write(struct kprobe *kp, struct pt_regs *regs)
 {
-  pr_info("cdc_acm: write function interrupt");
+  kt_stack_hit(KT_PROBE_WRITE, kp);
+  if (READ_ONCE(log_hits))
+    pr_info("%s: write function interrupt", target);
   return 0;
 }
 
 static int pre_handler_close(struct kprobe *kp, struct pt_regs *regs)
 {
-  pr_info("cdc_acm: close function interrupt");
+  kt_stack_hit(KT_PROBE_CLOSE, kp);
+  if (READ_ONCE(log_hits))
+    pr_info("%s: close function interrupt", target);
   return 0;
 }
 
-static int __init kprobe_init(void)
+/*
+ * Probes living in the target module. They can only be registered while
+ * the module is loaded, so they are (re)armed from the module notifier.
+ */
+struct kt_probe {
+  const char *symbol;
+  int lookup;               /* resolve through klookuper, not symbol_name */
+  kprobe_pre_handler_t handler;
+  struct kprobe kp;
+  int armed;
+};
+
+const char *const kt_probe_names[KT_PROBE_BASE_NR] = {
+  [KT_PROBE_OPEN]  = "open",
+  [KT_PROBE_READ]  = "read",
+  [KT_PROBE_WRITE] = "write",
+  [KT_PROBE_CLOSE] = "close",
+};
+
+static struct kt_probe acm_probes[KT_PROBE_BASE_NR] = {
+  [KT_PROBE_OPEN]  = { .symbol = "acm_tty_open",
+                       .handler = pre_handler_open  },
+  [KT_PROBE_READ]  = { .symbol = "acm_read_bulk_callback",
+                       .handler = pre_handler_read, .lookup = 1 },
+  [KT_PROBE_WRITE] = { .symbol = "acm_tty_write",
+                       .handler = pre_handler_write },
+  [KT_PROBE_CLOSE] = { .symbol = "acm_tty_close",
+                       .handler = pre_handler_close },
+};
+
+static struct kt_probe my_usb_probes[KT_PROBE_BASE_NR] = {
+  [KT_PROBE_OPEN]  = { .symbol = "my_tty_open",
+                       .handler = pre_handler_open  },
+  [KT_PROBE_READ]  = { .symbol = "my_usb_read_bulk_callback",
+                       .handler = pre_handler_read  },
+  [KT_PROBE_WRITE] = { .symbol = "my_tty_write",
+                       .handler = pre_handler_write },
+  [KT_PROBE_CLOSE] = { .symbol = "my_tty_close",
+                       .handler = pre_handler_close },
+};
+
+struct kt_target {
+  const char *module;
+  struct kt_probe *probes;
+  int nr;
+};
+
+static const struct kt_target targets[] = {
+  { "cdc_acm",       acm_probes,    ARRAY_SIZE(acm_probes)    },
+  { "my_usb_serial", my_usb_probes, ARRAY_SIZE(my_usb_probes) },
+};
+
+static const struct kt_target *tgt;
+
+/* optional tracing on top of the basic probes, armed along with them */
+static const struct kt_feature *features[] = {
+  &urb_trace_feature,
+  &rx_trace_feature,
+  &aggr_feature,
+  &stacks_feature,
+  &filter_feature,
+#ifdef KT_LOOKUP_BENCH
+  &lookup_bench_feature,
+#endif
+  &flight_feature,          /* consumers before the events producer */
+  &stream_feature,
+  &events_feature,
+};
+
+static int feature_armed[ARRAY_SIZE(features)];
+
+static struct dentry *kt_debugfs;
+
+/* serializes arming between module init and the module notifier */
+static DEFINE_MUTEX(probes_lock);
+
+static int arm_probe(struct kt_probe *p, size_t addr)
 {
-  pr_info("cdc_acm: kprobe register");
   int retval;
-  size_t addr;
-//  unsigned long addr;
-  //  open
-  kp_open.symbol_name = "acm_tty_open";
-  kp_open.pre_handler = pre_handler_open;
-  retval = register_kprobe(&kp_open);
-  if(retval < 0) {
-    pr_err("Kprobe registration for open function failed. Error number: %d", retval);
-    return retval;
-  }
 
-  //  read
-  //kp_read.symbol_name = "acm_submit_read_urb";
+  /* a struct kprobe has to be pristine before it is registered again */
+  memset(&p->kp, 0, sizeof(p->kp));
+
+  if (p->lookup) {
 #ifdef CONFIG_KALLSYMS
-  retval = kallsyms_addr_lookup("acm_read_bulk_callback", &addr, NULL, NULL);
-  if (addr == 0) {
-      pr_err("Failed to find acm_read_bulk_callback symbol address");
+    if (addr == 0)
       return -EINVAL;
+    p->kp.addr = (void*)addr;
+#else
+    pr_err("kallsyms_lookup_name is not available in this kernel configuration");
+    return 0;
+#endif
+  } else {
+    p->kp.symbol_name = p->symbol;
   }
-  kp_read.addr = (void*)addr;//0xffffffffc32ea9a0;
-  kp_read.pre_handler = pre_handler_read;
-  retval = register_kprobe(&kp_read);
+
+  p->kp.pre_handler = p->handler;
+  retval = register_kprobe(&p->kp);
   if(retval < 0) {
-    pr_err("Kprobe registration for open function failed. Error number: %d", retval);
-    unregister_kprobe(&kp_open);
+    pr_err("Kprobe registration for %s failed. Error number: %d",
+           p->symbol, retval);
     return retval;
   }
+
+  p->armed = 1;
+  return 0;
+}
+
+static void disarm_probes_locked(void)
+{
+  for (int i = ARRAY_SIZE(features) - 1; i >= 0; i--) {
+    if (!feature_armed[i])
+      continue;
+    if (features[i]->disarm)
+      features[i]->disarm();
+    feature_armed[i] = 0;
+  }
+
+  for (int i = tgt->nr - 1; i >= 0; i--) {
+    if (!tgt->probes[i].armed)
+      continue;
+    unregister_kprobe(&tgt->probes[i].kp);
+    tgt->probes[i].armed = 0;
+  }
+}
+
+void *kt_probe_addr(enum kt_probe_id id)
+{
+  struct kt_probe *p = &tgt->probes[id];
+
+  return p->armed ? p->kp.addr : NULL;
+}
+
+/* the target module, found through one of our probes when not notified */
+static struct module *probed_module(void)
+{
+  struct module *mod = NULL;
+
+  preempt_disable();
+  for (int i = 0; i < tgt->nr && !mod; i++) {
+    if (tgt->probes[i].armed)
+      mod = __module_text_address((unsigned long)tgt->probes[i].kp.addr);
+  }
+  preempt_enable();
+
+  return mod;
+}
+
+/* one klookuper batch for every probe that needs it, not a scan per probe */
+static int resolve_probes(size_t *addrs)
+{
+  struct ksym_query q[KT_PROBE_BASE_NR];
+  int idx[KT_PROBE_BASE_NR];
+  int nr = 0, retval;
+
+  for (int i = 0; i < tgt->nr; i++) {
+    addrs[i] = 0;
+    if (tgt->probes[i].armed || !tgt->probes[i].lookup)
+      continue;
+    q[nr] = (struct ksym_query) { .name = tgt->probes[i].symbol };
+    idx[nr++] = i;
+  }
+  if (!nr)
+    return 0;
+
+#ifdef CONFIG_KALLSYMS
+  retval = kallsyms_addr_lookup_batch(q, nr);
+  for (int j = 0; j < nr; j++) {
+    if (q[j].error)
+      pr_err("Failed to find %s symbol address", q[j].name);
+    else
+      addrs[idx[j]] = q[j].addr;
+  }
+  return retval;
 #else
-  pr_err("kallsyms_lookup_name is not available in this kernel configuration");
+  return 0;
 #endif
-  //  write
-  kp_write.symbol_name = "acm_tty_write";
-  kp_write.pre_handler = pre_handler_write;
-  retval = register_kprobe(&kp_write);
-  if(retval < 0) {
-    pr_err("Kprobe registration for write function failed. Error number: %d", retval);
-    unregister_kprobe(&kp_open);
-    unregister_kprobe(&kp_read);
-    return retval;
+}
+
+static int arm_probes(struct module *mod)
+{
+  size_t addrs[KT_PROBE_BASE_NR];
+  int retval = 0;
+
+  mutex_lock(&probes_lock);
+  retval = resolve_probes(addrs);
+  if (retval < 0)
+    goto out_unlock;
+
+  for (int i = 0; i < tgt->nr; i++) {
+    if (tgt->probes[i].armed)
+      continue;
+    retval = arm_probe(&tgt->probes[i], addrs[i]);
+    if (retval < 0) {
+      disarm_probes_locked();
+      goto out_unlock;
+    }
   }
 
-  //  close
-  kp_close.symbol_name = "acm_tty_close";
-  kp_close.pre_handler = pre_handler_close;
-  retval = register_kprobe(&kp_close);
-  if(retval < 0) {
-    pr_err("Kprobe registration for close function failed. Error number: %d", retval);
-    unregister_kprobe(&kp_open);
-    unregister_kprobe(&kp_read);
-    unregister_kprobe(&kp_write);
+  if (!mod)
+    mod = probed_module();
+
+  /* features are optional, a failing one does not hold back the rest */
+  for (int i = 0; i < ARRAY_SIZE(features) && mod; i++) {
+    if (feature_armed[i])
+      continue;
+    if (features[i]->arm && features[i]->arm(mod))
+      pr_err("%s: failed to arm %s", target, features[i]->name);
+    else
+      feature_armed[i] = 1;
+  }
+
+out_unlock:
+  mutex_unlock(&probes_lock);
+
+  if (!retval)
+    pr_info("%s: kprobes armed", target);
+  return retval;
+}
+
+static void disarm_probes(void)
+{
+  mutex_lock(&probes_lock);
+  disarm_probes_locked();
+  mutex_unlock(&probes_lock);
+  pr_info("%s: kprobes disarmed", target);
+}
+
+static int kprobe_module_notify(struct notifier_block *nb,
+                                unsigned long action, void *data)
+{
+  struct module *mod = data;
+
+  if (strcmp(mod->name, tgt->module))
+    return NOTIFY_DONE;
+
+  switch (action) {
+  case MODULE_STATE_LIVE:
+    arm_probes(mod);
+    break;
+  case MODULE_STATE_GOING:
+    disarm_probes();
+    break;
+  default:
+    break;
+  }
+
+  return NOTIFY_OK;
+}
+
+static struct notifier_block kprobe_module_nb = {
+  .notifier_call = kprobe_module_notify,
+};
+
+static void features_exit(int nr)
+{
+  while (nr--) {
+    if (features[nr]->exit)
+      features[nr]->exit();
+  }
+}
+
+static int __init kprobe_init(void)
+{
+  pr_info("%s: kprobe register", target);
+  int retval;
+  int i;
+
+  for (int t = 0; t < ARRAY_SIZE(targets); t++) {
+    if (!strcmp(target, targets[t].module))
+      tgt = &targets[t];
+  }
+  if (!tgt) {
+    pr_err("Unknown target module %s", target);
+    return -EINVAL;
+  }
+
+  /* probes are re-resolved whenever the target reloads */
+  retval = klookup_cache_init();
+  if (retval)
     return retval;
+
+  kt_debugfs = debugfs_create_dir("kprobe_test", NULL);
+
+  for (i = 0; i < ARRAY_SIZE(features); i++) {
+    retval = features[i]->init ? features[i]->init(kt_debugfs) : 0;
+    if (retval) {
+      pr_err("Init of %s failed. Error number: %d", features[i]->name, retval);
+      goto out_features;
+    }
+  }
+
+  /* register first so a target load racing with us is never missed */
+  retval = register_module_notifier(&kprobe_module_nb);
+  if (retval) {
+    pr_err("Module notifier registration failed. Error number: %d", retval);
+    goto out_features;
   }
 
+  /* the target may already be live; otherwise the notifier arms us later */
+  retval = arm_probes(NULL);
+  if (retval < 0)
+    pr_info("%s: not available yet (%d), waiting for it to load",
+            target, retval);
+
   return 0;
+
+out_features:
+  features_exit(i);
+  debugfs_remove_recursive(kt_debugfs);
+  klookup_cache_exit();
+  return retval;
 }
 
 static void __exit kprobe_exit(void)
 {
-  pr_info("cdc_acm: krpobe unregister");
-  unregister_kprobe(&kp_open);
-  unregister_kprobe(&kp_read);
-  unregister_kprobe(&kp_write);
-  unregister_kprobe(&kp_close);
+  pr_info("%s: krpobe unregister", target);
+  unregister_module_notifier(&kprobe_module_nb);
+  disarm_probes();
+  /* readers may still hold the files open until they are removed */
+  debugfs_remove_recursive(kt_debugfs);
+  features_exit(ARRAY_SIZE(features));
+  klookup_cache_exit();
 }
 
 module_init(kprobe_init);
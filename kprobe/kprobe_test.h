@@ -0,0 +1,119 @@
+#ifndef KPROBE_TEST_H
+#define KPROBE_TEST_H
+
+#include <linux/types.h>
+#include <linux/timekeeping.h>
+#include <linux/log2.h>
+
+struct module;
+struct dentry;
+struct seq_file;
+
+/* driver module whose ttys and URBs are traced, cdc_acm by default */
+extern char *target;
+
+/* basic probes on the target driver, in the order they are armed */
+enum kt_probe_id {
+  KT_PROBE_OPEN,
+  KT_PROBE_READ,            /* bulk-in URB completion handler */
+  KT_PROBE_WRITE,
+  KT_PROBE_CLOSE,
+  KT_PROBE_BASE_NR,
+};
+
+extern const char *const kt_probe_names[KT_PROBE_BASE_NR];
+
+/* resolved address of an armed basic probe, NULL when it is not armed */
+extern void *kt_probe_addr(enum kt_probe_id id);
+
+/* NMI-safe, usable from any probe handler */
+static __always_inline u64 kt_now(void)
+{
+  return ktime_get_mono_fast_ns();
+}
+
+/*
+ * log2 histogram: bucket 0 holds zero, bucket n holds [2^(n-1), 2^n).
+ * Kept per-CPU by its users, so adding a sample needs no atomics.
+ */
+#define KT_HIST_BUCKETS 40
+
+struct kt_hist {
+  u64 count;
+  u64 sum;
+  u64 max;
+  u64 bucket[KT_HIST_BUCKETS];
+};
+
+static __always_inline void kt_hist_add(struct kt_hist *h, u64 val)
+{
+  unsigned int b = val ? min_t(unsigned int, ilog2(val) + 1,
+                               KT_HIST_BUCKETS - 1) : 0;
+
+  h->count++;
+  h->sum += val;
+  if (val > h->max)
+    h->max = val;
+  h->bucket[b]++;
+}
+
+extern void kt_hist_merge(struct kt_hist *dst, const struct kt_hist *src);
+extern void kt_hist_show(struct seq_file *m, const char *title,
+                         const char *unit, const struct kt_hist *h);
+
+/*
+ * An optional tracing feature. init/exit run at module load/unload and
+ * get the debugfs directory to publish into; arm/disarm follow the life
+ * of the target module, which is passed to arm. Any of them may be NULL.
+ */
+struct kt_feature {
+  const char *name;
+  int (*init)(struct dentry *dir);
+  void (*exit)(void);
+  int (*arm)(struct module *mod);
+  void (*disarm)(void);
+};
+
+extern const struct kt_feature urb_trace_feature;
+extern const struct kt_feature rx_trace_feature;
+extern const struct kt_feature aggr_feature;
+extern const struct kt_feature stacks_feature;
+extern const struct kt_feature flight_feature;
+extern const struct kt_feature filter_feature;
+extern const struct kt_feature stream_feature;
+extern const struct kt_feature events_feature;
+#ifdef KT_LOOKUP_BENCH
+extern const struct kt_feature lookup_bench_feature;
+#endif
+
+struct kprobe;
+
+/* called from the basic probe handlers, samples the stack when enabled */
+extern void kt_stack_hit(enum kt_probe_id probe, struct kprobe *kp);
+
+struct kt_event;
+
+/* flight recorder, fed by the event producer; -EBUSY while it is frozen */
+extern bool kt_flight_enabled(void);
+extern int kt_flight_record(const struct kt_event *ev);
+
+/* mmap rings on /dev/kprobe_test; -ENOSPC when the reader is behind */
+extern bool kt_stream_enabled(void);
+extern int kt_stream_record(const struct kt_event *ev);
+
+enum kt_filter_result {
+  KT_SKIPPED,               /* filtered, sampled out or over budget */
+  KT_RECORDED,
+  KT_DROPPED,               /* no consumer had room for it */
+};
+
+/*
+ * Sampling and predicates, checked before a record is built. now is the
+ * handler's start time, pass it back to kt_filter_done() with the outcome
+ * so the handler's cost is accounted to the probe.
+ */
+extern bool kt_filter(enum kt_probe_id probe, s32 tty, u32 len, u64 now);
+extern void kt_filter_done(enum kt_probe_id probe, u64 start,
+                           enum kt_filter_result res);
+
+#endif // KPROBE_TEST_H
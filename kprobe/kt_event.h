@@ -0,0 +1,54 @@
+#ifndef KPROBE_KT_EVENT_H
+#define KPROBE_KT_EVENT_H
+
+/*
+ * Event record produced by kprobe_test. Shared with userspace tools, so it
+ * only uses fixed size types and must keep its layout.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+enum kt_event_type {
+  KT_EV_ENTRY,              /* function entered */
+  KT_EV_RETURN,             /* function returned, val is the latency */
+};
+
+struct kt_event {
+  __u64 ts;                 /* CLOCK_MONOTONIC, ns */
+  __u64 val;                /* latency in ns for KT_EV_RETURN */
+  __u32 pid;                /* 0 when not hit in task context */
+  __u32 len;                /* bytes asked for / transferred, or retval */
+  __s32 tty;                /* tty index, -1 when unknown */
+  __u8  probe;              /* enum kt_probe_id */
+  __u8  type;               /* enum kt_event_type */
+  __u16 cpu;
+  char  comm[16];
+};
+
+/*
+ * Streaming rings, one per possible CPU, exported by /dev/kprobe_test.
+ * CPU n's ring is mapped at offset n * ring_bytes: a header page followed
+ * by ring_events records. The kernel only moves head, the reader only
+ * moves tail; both are free running counters.
+ */
+struct kt_ring_header {
+  __u64 head;               /* next record the kernel writes */
+  __u64 tail;               /* next record the reader consumes */
+  __u64 lost;               /* records dropped because the ring was full */
+  __u32 ring_events;        /* a power of 2 */
+  __u32 event_size;
+};
+
+struct kt_stream_info {
+  __u32 nr_cpus;            /* rings to map, including offline CPUs */
+  __u32 ring_events;
+  __u32 event_size;
+  __u32 header_size;        /* offset of the first record in a ring */
+  __u64 ring_bytes;
+};
+
+#define KT_IOC_MAGIC 'k'
+#define KT_IOC_INFO _IOR(KT_IOC_MAGIC, 1, struct kt_stream_info)
+
+#endif // KPROBE_KT_EVENT_H
@@ -0,0 +1,32 @@
+#ifndef KT_RING_H
+#define KT_RING_H
+
+#include<linux/types.h>
+#include<linux/errno.h>
+#include<asm/barrier.h>
+
+#include "kt_event.h"
+
+/*
+ * Producer side of a kt_ring_header ring. Inline so a probe handler pays
+ * no call for it; the caller keeps the private head and must be the only
+ * producer on the ring (per CPU, preemption off). Returns the number of
+ * records now queued, or -ENOSPC when the reader has fallen behind.
+ */
+static __always_inline long kt_ring_push(struct kt_ring_header *hdr,
+                                         struct kt_event *ring, u32 mask,
+                                         u64 *head, const struct kt_event *ev)
+{
+  u64 used = *head - smp_load_acquire(&hdr->tail);
+
+  if (used > mask) {
+    WRITE_ONCE(hdr->lost, hdr->lost + 1);
+    return -ENOSPC;
+  }
+
+  ring[*head & mask] = *ev;
+  smp_store_release(&hdr->head, ++*head);
+  return used + 1;
+}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Compares the klookuper backends: reading debugfs lookup_bench resolves a
+ * few symbols with each backend and prints the time per lookup. The missing
+ * symbol is the worst case for procfs, it has to read the whole table.
+ * The last rows symbolize addresses spread over a megabyte of kernel text
+ * and enumerate a driver's functions by pattern, scoped and unscoped.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/seq_file.h>
+#include<linux/debugfs.h>
+#include<linux/math64.h>
+#include<linux/sched.h>
+#include<linux/slab.h>
+#include<linux/sizes.h>
+
+#include "klookuper/lookuper.h"
+#include "kprobe_test.h"
+
+static unsigned int lookup_bench_native = 1000;
+module_param(lookup_bench_native, uint, 0644);
+MODULE_PARM_DESC(lookup_bench_native, "Native lookups per symbol in lookup_bench");
+
+static unsigned int lookup_bench_procfs = 3;
+module_param(lookup_bench_procfs, uint, 0644);
+MODULE_PARM_DESC(lookup_bench_procfs, "/proc/kallsyms lookups per symbol in lookup_bench");
+
+static const char *const bench_symbols[] = {
+  "tty_flip_buffer_push",       /* vmlinux */
+  "acm_read_bulk_callback",     /* cdc_acm, kprobe_test resolves this one */
+  "kt_no_such_symbol",          /* full scan */
+};
+
+static const struct {
+  const char *name;
+  enum klookup_backend backend;
+  unsigned int *loops;
+} bench_backends[] = {
+  { "native", KLOOKUP_NATIVE, &lookup_bench_native },
+  { "procfs", KLOOKUP_PROCFS, &lookup_bench_procfs },
+  { "cache", KLOOKUP_CACHE, &lookup_bench_native },
+};
+
+static void lookup_bench_reverse(struct seq_file *m)
+{
+  unsigned int loops = max(READ_ONCE(lookup_bench_native), 1U), hits = 0;
+  struct klookup_sym *sym;
+  size_t base;
+  u64 start, ns;
+  int ret;
+
+  ret = kallsyms_addr_lookup_backend(bench_symbols[0], &base, NULL, NULL,
+                                     KLOOKUP_CACHE);
+  if (ret) {
+    seq_printf(m, "addr_to_sym: no base address (%d)\n", ret);
+    return;
+  }
+
+  sym = kmalloc(sizeof(*sym), GFP_KERNEL);
+  if (!sym)
+    return;
+
+  start = kt_now();
+  for (unsigned int i = 0; i < loops; i++) {
+    unsigned long addr = base + (i * 4099UL) % SZ_1M;
+
+    hits += !klookup_addr_to_sym(addr, sym);
+  }
+  ns = kt_now() - start;
+
+  seq_printf(m, "%-24s %-8s %8u %14llu %18s %6u hits\n", "addr_to_sym", "cache",
+             loops, div_u64(ns, loops), "", hits);
+  kfree(sym);
+}
+
+static int lookup_bench_count(const char *name, unsigned long addr, char type,
+                              const char *module, void *data)
+{
+  (*(unsigned int *)data)++;
+  return 0;
+}
+
+static void lookup_bench_enum(struct seq_file *m, const char *pattern,
+                              const char *module)
+{
+  unsigned int matches = 0;
+  u64 start, ns;
+  int ret;
+
+  start = kt_now();
+  ret = klookup_enum_symbols(pattern, module, "tT", lookup_bench_count,
+                             &matches);
+  ns = kt_now() - start;
+
+  seq_printf(m, "%-24s %-8s %8u %14llu %18s %6d %u functions\n", pattern,
+             module ? module : "any", 1, ns, "", ret, matches);
+}
+
+static int lookup_bench_show(struct seq_file *m, void *v)
+{
+  seq_printf(m, "%-24s %-8s %8s %14s %18s %6s\n", "symbol", "backend",
+             "lookups", "ns/lookup", "addr", "error");
+
+  for (int s = 0; s < ARRAY_SIZE(bench_symbols); s++) {
+    for (int b = 0; b < ARRAY_SIZE(bench_backends); b++) {
+      unsigned int loops = max(READ_ONCE(*bench_backends[b].loops), 1U);
+      size_t addr = 0;
+      u64 start, ns;
+      int ret = 0;
+
+      start = kt_now();
+      for (unsigned int i = 0; i < loops; i++) {
+        ret = kallsyms_addr_lookup_backend(bench_symbols[s], &addr, NULL,
+                                           NULL, bench_backends[b].backend);
+        cond_resched();
+      }
+      ns = kt_now() - start;
+
+      seq_printf(m, "%-24s %-8s %8u %14llu %#18lx %6d\n", bench_symbols[s],
+                 bench_backends[b].name, loops, div_u64(ns, loops),
+                 (unsigned long)addr, ret);
+    }
+  }
+
+  lookup_bench_reverse(m);
+  lookup_bench_enum(m, "acm_*", "cdc_acm");
+  lookup_bench_enum(m, "acm_*", NULL);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lookup_bench);
+
+static int lookup_bench_init(struct dentry *dir)
+{
+  debugfs_create_file("lookup_bench", 0400, dir, NULL, &lookup_bench_fops);
+  return 0;
+}
+
+const struct kt_feature lookup_bench_feature = {
+  .name = "lookup_bench",
+  .init = lookup_bench_init,
+};
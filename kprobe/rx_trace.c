@@ -0,0 +1,330 @@
+/*
+ * RX path latency: from the target driver's bulk-in completion handler
+ * through tty_flip_buffer_push(), the flush_to_ldisc() work item and the
+ * n_tty receive path, split per stage.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/kprobes.h>
+#include<linux/tty.h>
+#include<linux/tty_flip.h>
+#include<linux/percpu.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/slab.h>
+
+#include "kprobe_test.h"
+
+enum rx_stage {
+  RX_CB_TO_PUSH,            /* completion handler entry -> flip push */
+  RX_PUSH_TO_FLUSH,         /* flip push -> flush_to_ldisc work runs */
+  RX_FLUSH_TO_LDISC,        /* work runs -> n_tty receives the data */
+  RX_TOTAL,                 /* completion handler entry -> n_tty */
+  RX_STAGE_NR,
+};
+
+static const char *const rx_stage_names[RX_STAGE_NR] = {
+  [RX_CB_TO_PUSH]     = "callback->flip push",
+  [RX_PUSH_TO_FLUSH]  = "flip push->flush_to_ldisc",
+  [RX_FLUSH_TO_LDISC] = "flush_to_ldisc->n_tty",
+  [RX_TOTAL]          = "callback->n_tty",
+};
+
+/*
+ * Ports of interest are learned from flip pushes done inside the target's
+ * completion handler. The push happens on the URB CPU while the work item
+ * runs wherever the workqueue puts it, so per-port stamps are handed over
+ * with xchg/cmpxchg. A pending stamp keeps the oldest unconsumed push.
+ */
+#define RX_PORTS 8
+
+struct rx_port {
+  unsigned long port;       /* struct tty_port *, claimed with cmpxchg */
+  int index;                /* tty index when it was claimed, -1 if none */
+  u64 cb_ts;
+  u64 push_ts;
+  u64 flush_ts;
+  u64 flush_cb_ts;
+};
+
+static struct rx_port rx_ports[RX_PORTS];
+
+struct rx_cpu_stats {
+  struct kt_hist stage[RX_STAGE_NR];
+  u64 ports_full;
+};
+
+static struct rx_cpu_stats __percpu *rx_stats;
+
+/* completion handler entry, non-zero while it runs on this CPU */
+static DEFINE_PER_CPU(u64, rx_cb_ts);
+
+static struct rx_port *rx_port_find(const struct tty_port *port)
+{
+  for (int i = 0; i < RX_PORTS; i++) {
+    if (READ_ONCE(rx_ports[i].port) == (unsigned long)port)
+      return &rx_ports[i];
+  }
+  return NULL;
+}
+
+static struct rx_port *rx_port_claim(struct tty_port *port)
+{
+  struct rx_port *p = rx_port_find(port);
+
+  if (p)
+    return p;
+
+  for (int i = 0; i < RX_PORTS; i++) {
+    p = &rx_ports[i];
+    if (!READ_ONCE(p->port) && !cmpxchg(&p->port, 0, (unsigned long)port)) {
+      p->index = port->tty ? port->tty->index : -1;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static __always_inline void rx_stage_add(enum rx_stage stage, u64 from, u64 to)
+{
+  kt_hist_add(&this_cpu_ptr(rx_stats)->stage[stage], to > from ? to - from : 0);
+}
+
+static int rx_callback_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  __this_cpu_write(rx_cb_ts, kt_now());
+  return 0;
+}
+
+static int rx_callback_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  __this_cpu_write(rx_cb_ts, 0);
+  return 0;
+}
+
+static int pre_handler_flip_push(struct kprobe *kp, struct pt_regs *regs)
+{
+  struct tty_port *port = (struct tty_port *)regs_get_kernel_argument(regs, 0);
+  u64 cb_ts = __this_cpu_read(rx_cb_ts);
+  struct rx_port *p;
+  u64 now;
+
+  /* not pushed from the target's completion handler */
+  if (!cb_ts)
+    return 0;
+
+  now = kt_now();
+  p = rx_port_claim(port);
+  if (!p) {
+    this_cpu_inc(rx_stats->ports_full);
+    return 0;
+  }
+
+  rx_stage_add(RX_CB_TO_PUSH, cb_ts, now);
+  if (!cmpxchg(&p->push_ts, 0, now))
+    WRITE_ONCE(p->cb_ts, cb_ts);
+  return 0;
+}
+
+static int pre_handler_flush_to_ldisc(struct kprobe *kp, struct pt_regs *regs)
+{
+  struct work_struct *work = (struct work_struct *)regs_get_kernel_argument(regs, 0);
+  struct rx_port *p = rx_port_find(container_of(work, struct tty_port, buf.work));
+  u64 push_ts, now;
+
+  if (!p)
+    return 0;
+
+  push_ts = xchg(&p->push_ts, 0);
+  if (!push_ts)
+    return 0;
+
+  now = kt_now();
+  rx_stage_add(RX_PUSH_TO_FLUSH, push_ts, now);
+  WRITE_ONCE(p->flush_cb_ts, READ_ONCE(p->cb_ts));
+  WRITE_ONCE(p->flush_ts, now);
+  return 0;
+}
+
+static int pre_handler_ldisc_receive(struct kprobe *kp, struct pt_regs *regs)
+{
+  struct tty_struct *tty = (struct tty_struct *)regs_get_kernel_argument(regs, 0);
+  struct rx_port *p;
+  u64 flush_ts, now;
+
+  if (!tty || !tty->port)
+    return 0;
+
+  p = rx_port_find(tty->port);
+  if (!p)
+    return 0;
+
+  /* a flush may hand several chunks to the ldisc, time the first one */
+  flush_ts = xchg(&p->flush_ts, 0);
+  if (!flush_ts)
+    return 0;
+
+  now = kt_now();
+  rx_stage_add(RX_FLUSH_TO_LDISC, flush_ts, now);
+  rx_stage_add(RX_TOTAL, READ_ONCE(p->flush_cb_ts), now);
+  return 0;
+}
+
+static struct kretprobe krp_callback;
+static struct kprobe kp_flip_push;
+static struct kprobe kp_flush;
+
+/* n_tty uses receive_buf2 when present, older kernels only receive_buf */
+static struct kprobe kp_ldisc[] = {
+  { .symbol_name = "n_tty_receive_buf2" },
+  { .symbol_name = "n_tty_receive_buf" },
+};
+
+static int ldisc_armed[ARRAY_SIZE(kp_ldisc)];
+
+static void rx_trace_disarm_ldisc(void)
+{
+  for (int i = 0; i < ARRAY_SIZE(kp_ldisc); i++) {
+    if (ldisc_armed[i])
+      unregister_kprobe(&kp_ldisc[i]);
+    ldisc_armed[i] = 0;
+  }
+}
+
+static int rx_trace_arm(struct module *mod)
+{
+  void *callback = kt_probe_addr(KT_PROBE_READ);
+  int retval, armed = 0;
+
+  if (!callback)
+    return -ENOENT;
+
+  memset(rx_ports, 0, sizeof(rx_ports));
+
+  for (int i = 0; i < ARRAY_SIZE(kp_ldisc); i++) {
+    const char *symbol = kp_ldisc[i].symbol_name;
+
+    memset(&kp_ldisc[i], 0, sizeof(kp_ldisc[i]));
+    kp_ldisc[i].symbol_name = symbol;
+    kp_ldisc[i].pre_handler = pre_handler_ldisc_receive;
+    ldisc_armed[i] = register_kprobe(&kp_ldisc[i]) == 0;
+    armed |= ldisc_armed[i];
+  }
+  if (!armed) {
+    pr_err("Kprobe registration for n_tty receive failed");
+    return -ENOENT;
+  }
+
+  memset(&kp_flush, 0, sizeof(kp_flush));
+  kp_flush.symbol_name = "flush_to_ldisc";
+  kp_flush.pre_handler = pre_handler_flush_to_ldisc;
+  retval = register_kprobe(&kp_flush);
+  if (retval < 0) {
+    pr_err("Kprobe registration for flush_to_ldisc failed. Error number: %d",
+           retval);
+    goto out_ldisc;
+  }
+
+  memset(&kp_flip_push, 0, sizeof(kp_flip_push));
+  kp_flip_push.symbol_name = "tty_flip_buffer_push";
+  kp_flip_push.pre_handler = pre_handler_flip_push;
+  retval = register_kprobe(&kp_flip_push);
+  if (retval < 0) {
+    pr_err("Kprobe registration for tty_flip_buffer_push failed. Error number: %d",
+           retval);
+    goto out_flush;
+  }
+
+  memset(&krp_callback, 0, sizeof(krp_callback));
+  krp_callback.kp.addr = callback;
+  krp_callback.entry_handler = rx_callback_entry;
+  krp_callback.handler = rx_callback_ret;
+  retval = register_kretprobe(&krp_callback);
+  if (retval < 0) {
+    pr_err("Kretprobe registration for the read callback failed. Error number: %d",
+           retval);
+    goto out_push;
+  }
+
+  return 0;
+
+out_push:
+  unregister_kprobe(&kp_flip_push);
+out_flush:
+  unregister_kprobe(&kp_flush);
+out_ldisc:
+  rx_trace_disarm_ldisc();
+  return retval;
+}
+
+static void rx_trace_disarm(void)
+{
+  int cpu;
+
+  unregister_kretprobe(&krp_callback);
+  unregister_kprobe(&kp_flip_push);
+  unregister_kprobe(&kp_flush);
+  rx_trace_disarm_ldisc();
+
+  for_each_possible_cpu(cpu)
+    per_cpu(rx_cb_ts, cpu) = 0;
+}
+
+static int rx_latency_show(struct seq_file *m, void *v)
+{
+  struct kt_hist *sum;
+  u64 ports_full = 0;
+  int cpu;
+
+  sum = kcalloc(RX_STAGE_NR, sizeof(*sum), GFP_KERNEL);
+  if (!sum)
+    return -ENOMEM;
+
+  for_each_possible_cpu(cpu) {
+    struct rx_cpu_stats *stats = per_cpu_ptr(rx_stats, cpu);
+
+    for (int i = 0; i < RX_STAGE_NR; i++)
+      kt_hist_merge(&sum[i], &stats->stage[i]);
+    ports_full += stats->ports_full;
+  }
+
+  seq_puts(m, "ports:");
+  for (int i = 0; i < RX_PORTS; i++) {
+    if (READ_ONCE(rx_ports[i].port))
+      seq_printf(m, " %d", rx_ports[i].index);
+  }
+  seq_printf(m, "\nports table full %llu\n", ports_full);
+
+  for (int i = 0; i < RX_STAGE_NR; i++) {
+    seq_putc(m, '\n');
+    kt_hist_show(m, rx_stage_names[i], "ns", &sum[i]);
+  }
+
+  kfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rx_latency);
+
+static int rx_trace_init(struct dentry *dir)
+{
+  rx_stats = alloc_percpu(struct rx_cpu_stats);
+  if (!rx_stats)
+    return -ENOMEM;
+
+  debugfs_create_file("rx_latency", 0444, dir, NULL, &rx_latency_fops);
+  return 0;
+}
+
+static void rx_trace_exit(void)
+{
+  free_percpu(rx_stats);
+}
+
+const struct kt_feature rx_trace_feature = {
+  .name = "rx_trace",
+  .init = rx_trace_init,
+  .exit = rx_trace_exit,
+  .arm = rx_trace_arm,
+  .disarm = rx_trace_disarm,
+};
@@ -0,0 +1,262 @@
+/*
+ * Sampled kernel stack capture at the basic probe hits. Identical stacks
+ * are folded into per-CPU hash tables and printed in the folded format
+ * flamegraph.pl / inferno read, one "outer;...;probed count" per line.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/kprobes.h>
+#include<linux/stacktrace.h>
+#include<linux/jhash.h>
+#include<linux/percpu.h>
+#include<linux/mutex.h>
+#include<linux/vmalloc.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+
+#include "kprobe_test.h"
+
+static unsigned int stack_sample;
+
+#define STACK_DEPTH 24
+#define STACK_BITS  8
+#define STACK_SLOTS (1 << STACK_BITS)
+
+struct stack_entry {
+  u32 hash;                 /* 0 marks a free slot, set last on insert */
+  u16 probe;
+  u16 nr;
+  u64 count;
+  unsigned long ip[STACK_DEPTH];
+};
+
+/* owned by one CPU, like the aggr tables; clears are done by the owner */
+struct stack_table {
+  struct stack_entry entry[STACK_SLOTS];
+  unsigned int tick;
+  int reset;
+  u64 full;
+};
+
+/*
+ * Made the first time sampling is switched on and kept until unload, so
+ * the handlers never see a table go away; NULL until then.
+ */
+static DEFINE_PER_CPU(struct stack_table *, stack_tables);
+static DEFINE_MUTEX(stacks_lock);
+static bool stacks_live;        /* between init and exit */
+
+/* process context only; a CPU left without a table just takes no samples */
+static int stacks_alloc(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct stack_table *t;
+
+    if (per_cpu(stack_tables, cpu))
+      continue;
+    /* too big for the per-CPU allocator, use node local vmalloc instead */
+    t = vzalloc_node(sizeof(*t), cpu_to_node(cpu));
+    if (!t)
+      return -ENOMEM;
+    smp_store_release(per_cpu_ptr(&stack_tables, cpu), t);
+  }
+  return 0;
+}
+
+static int stack_sample_set(const char *val, const struct kernel_param *kp)
+{
+  unsigned int sample;
+  int retval = kstrtouint(val, 0, &sample);
+
+  if (retval)
+    return retval;
+
+  /* tables before the rate, a handler never samples without one */
+  mutex_lock(&stacks_lock);
+  if (sample && stacks_live)
+    retval = stacks_alloc();
+  if (!retval)
+    WRITE_ONCE(stack_sample, sample);
+  mutex_unlock(&stacks_lock);
+  return retval;
+}
+
+static const struct kernel_param_ops stack_sample_ops = {
+  .set = stack_sample_set,
+  .get = param_get_uint,
+};
+
+module_param_cb(stack_sample, &stack_sample_ops, &stack_sample, 0644);
+MODULE_PARM_DESC(stack_sample, "Capture the stack on 1 in N probe hits, 0 = off");
+
+/*
+ * The unwinder starts inside this handler and the kprobe core. Drop those
+ * frames: the probed function shows up at (or just after, for ftrace based
+ * probes) the probe address.
+ */
+static unsigned int stack_trim(unsigned long *ip, unsigned int nr,
+                               unsigned long probe_addr)
+{
+  for (unsigned int i = 0; i < nr; i++) {
+    if (ip[i] - probe_addr < 16) {
+      memmove(ip, ip + i, (nr - i) * sizeof(*ip));
+      return nr - i;
+    }
+  }
+  return nr;
+}
+
+void kt_stack_hit(enum kt_probe_id probe, struct kprobe *kp)
+{
+  unsigned int sample = READ_ONCE(stack_sample);
+  struct stack_table *t;
+  unsigned long ip[STACK_DEPTH + 8];
+  unsigned int nr, idx;
+  u32 hash;
+
+  if (!sample)
+    return;
+
+  t = smp_load_acquire(this_cpu_ptr(&stack_tables));
+  if (!t || ++t->tick < sample)
+    return;
+  t->tick = 0;
+
+  if (unlikely(t->reset)) {
+    memset(t->entry, 0, sizeof(t->entry));
+    t->full = 0;
+    WRITE_ONCE(t->reset, 0);
+  }
+
+  nr = stack_trace_save(ip, ARRAY_SIZE(ip), 0);
+  nr = min_t(unsigned int, stack_trim(ip, nr, (unsigned long)kp->addr),
+             STACK_DEPTH);
+  hash = jhash(ip, nr * sizeof(*ip), probe) | 1;
+  idx = hash & (STACK_SLOTS - 1);
+
+  for (int i = 0; i < STACK_SLOTS; i++) {
+    struct stack_entry *e = &t->entry[(idx + i) & (STACK_SLOTS - 1)];
+
+    if (!e->hash) {
+      e->probe = probe;
+      e->nr = nr;
+      e->count = 1;
+      memcpy(e->ip, ip, nr * sizeof(*ip));
+      smp_wmb();
+      WRITE_ONCE(e->hash, hash);
+      return;
+    }
+
+    if (e->hash == hash && e->probe == probe && e->nr == nr
+        && !memcmp(e->ip, ip, nr * sizeof(*ip))) {
+      e->count++;
+      return;
+    }
+  }
+
+  t->full++;
+}
+
+static int stacks_show(struct seq_file *m, void *v)
+{
+  u64 full = 0;
+  int cpu;
+
+  /* no merging across CPUs, the flame graph tools sum equal lines */
+  for_each_possible_cpu(cpu) {
+    struct stack_table *t = smp_load_acquire(per_cpu_ptr(&stack_tables, cpu));
+
+    if (!t || READ_ONCE(t->reset))
+      continue;
+
+    for (int i = 0; i < STACK_SLOTS; i++) {
+      struct stack_entry *e = &t->entry[i];
+
+      if (!READ_ONCE(e->hash))
+        continue;
+      smp_rmb();
+
+      /* outermost caller first, the probed function last */
+      for (int j = e->nr - 1; j >= 0; j--)
+        seq_printf(m, "%ps;", (void *)e->ip[j]);
+      seq_printf(m, "[%s] %llu\n", kt_probe_names[e->probe], e->count);
+    }
+    full += t->full;
+  }
+
+  if (full)
+    seq_printf(m, "# table full, %llu samples dropped\n", full);
+  return 0;
+}
+
+static int stacks_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, stacks_show, inode->i_private);
+}
+
+static ssize_t stacks_write(struct file *file, const char __user *buf,
+                            size_t len, loff_t *ppos)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct stack_table *t = smp_load_acquire(per_cpu_ptr(&stack_tables, cpu));
+
+    if (t)
+      WRITE_ONCE(t->reset, 1);
+  }
+
+  return len;
+}
+
+static const struct file_operations stacks_fops = {
+  .owner = THIS_MODULE,
+  .open = stacks_open,
+  .read = seq_read,
+  .write = stacks_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+/* the probes are gone by now, nothing samples into the tables any more */
+static void stacks_exit(void)
+{
+  int cpu;
+
+  mutex_lock(&stacks_lock);
+  stacks_live = false;
+  for_each_possible_cpu(cpu) {
+    vfree(per_cpu(stack_tables, cpu));
+    per_cpu(stack_tables, cpu) = NULL;
+  }
+  mutex_unlock(&stacks_lock);
+}
+
+static int stacks_init(struct dentry *dir)
+{
+  int retval = 0;
+
+  /* stack_sample given at load time was only stored, see stack_sample_set() */
+  mutex_lock(&stacks_lock);
+  stacks_live = true;
+  if (stack_sample)
+    retval = stacks_alloc();
+  mutex_unlock(&stacks_lock);
+  if (retval) {
+    stacks_exit();
+    return retval;
+  }
+
+  debugfs_create_file("stacks", 0644, dir, NULL, &stacks_fops);
+  return 0;
+}
+
+const struct kt_feature stacks_feature = {
+  .name = "stacks",
+  .init = stacks_init,
+  .exit = stacks_exit,
+};
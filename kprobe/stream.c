@@ -0,0 +1,219 @@
+/*
+ * Streaming event export: per-CPU single producer / single consumer rings
+ * in vmalloc memory that userspace maps through /dev/kprobe_test. Records
+ * are never overwritten, a full ring counts the record as lost instead.
+ * A reader sleeping in poll() is woken through irq_work once a ring holds
+ * stream_wakeup records, so producers never take a lock.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/moduleparam.h>
+#include<linux/fs.h>
+#include<linux/mm.h>
+#include<linux/miscdevice.h>
+#include<linux/vmalloc.h>
+#include<linux/irq_work.h>
+#include<linux/percpu.h>
+#include<linux/poll.h>
+#include<linux/wait.h>
+#include<linux/uaccess.h>
+
+#include "kprobe_test.h"
+#include "kt_event.h"
+#include "kt_ring.h"
+
+static bool stream;
+module_param(stream, bool, 0444);
+MODULE_PARM_DESC(stream, "Export events through mmap rings on /dev/kprobe_test");
+
+static unsigned int stream_events = 16384;
+module_param(stream_events, uint, 0444);
+MODULE_PARM_DESC(stream_events, "Records per CPU ring, rounded up to a power of 2");
+
+static unsigned int stream_wakeup = 64;
+module_param(stream_wakeup, uint, 0644);
+MODULE_PARM_DESC(stream_wakeup, "Wake the reader once a ring holds this many records");
+
+struct stream_ring {
+  struct kt_ring_header *hdr;   /* start of the vmalloc area */
+  struct kt_event *ev;
+  u64 head;                     /* private copy, hdr->head is published */
+};
+
+static DEFINE_PER_CPU(struct stream_ring, stream_rings);
+static u32 stream_mask;
+static size_t stream_ring_bytes;
+
+static DECLARE_WAIT_QUEUE_HEAD(stream_wq);
+static DEFINE_PER_CPU(struct irq_work, stream_irq_work);
+static atomic_t stream_readers = ATOMIC_INIT(0);
+
+bool kt_stream_enabled(void)
+{
+  return stream;
+}
+
+static void stream_wake(struct irq_work *work)
+{
+  wake_up_interruptible(&stream_wq);
+}
+
+int kt_stream_record(const struct kt_event *ev)
+{
+  struct stream_ring *r;
+  long used;
+
+  if (!stream)
+    return -EBUSY;
+
+  r = this_cpu_ptr(&stream_rings);
+  used = kt_ring_push(r->hdr, r->ev, stream_mask, &r->head, ev);
+  if (used < 0)
+    return used;
+
+  /* only the record crossing the watermark wakes, not every one after */
+  if (used == max(READ_ONCE(stream_wakeup), 1U)
+      && atomic_read(&stream_readers))
+    irq_work_queue(this_cpu_ptr(&stream_irq_work));
+  return 0;
+}
+
+static int stream_open(struct inode *inode, struct file *file)
+{
+  /* tails are shared, so is the stream, one reader at a time */
+  if (atomic_cmpxchg(&stream_readers, 0, 1))
+    return -EBUSY;
+  return nonseekable_open(inode, file);
+}
+
+static int stream_release(struct inode *inode, struct file *file)
+{
+  atomic_set(&stream_readers, 0);
+  return 0;
+}
+
+static int stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  unsigned long pages = stream_ring_bytes >> PAGE_SHIFT;
+  unsigned long cpu = vma->vm_pgoff / pages;
+
+  if (vma->vm_pgoff % pages || cpu >= nr_cpu_ids || !cpu_possible(cpu)
+      || !per_cpu(stream_rings, cpu).hdr)
+    return -EINVAL;
+  if (vma->vm_end - vma->vm_start != stream_ring_bytes)
+    return -EINVAL;
+
+  return remap_vmalloc_range(vma, per_cpu(stream_rings, cpu).hdr, 0);
+}
+
+static __poll_t stream_poll(struct file *file, poll_table *wait)
+{
+  int cpu;
+
+  poll_wait(file, &stream_wq, wait);
+
+  for_each_possible_cpu(cpu) {
+    struct kt_ring_header *hdr = per_cpu(stream_rings, cpu).hdr;
+
+    if (smp_load_acquire(&hdr->head) != READ_ONCE(hdr->tail))
+      return EPOLLIN | EPOLLRDNORM;
+  }
+  return 0;
+}
+
+static long stream_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+  struct kt_stream_info info = {
+    .nr_cpus = nr_cpu_ids,
+    .ring_events = stream_mask + 1,
+    .event_size = sizeof(struct kt_event),
+    .header_size = PAGE_SIZE,
+    .ring_bytes = stream_ring_bytes,
+  };
+
+  if (cmd != KT_IOC_INFO)
+    return -ENOTTY;
+  if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+    return -EFAULT;
+  return 0;
+}
+
+static const struct file_operations stream_fops = {
+  .owner = THIS_MODULE,
+  .open = stream_open,
+  .release = stream_release,
+  .mmap = stream_mmap,
+  .poll = stream_poll,
+  .unlocked_ioctl = stream_ioctl,
+  .llseek = noop_llseek,
+};
+
+static struct miscdevice stream_dev = {
+  .minor = MISC_DYNAMIC_MINOR,
+  .name = "kprobe_test",
+  .fops = &stream_fops,
+  .mode = 0600,
+};
+
+static void stream_exit(void)
+{
+  int cpu;
+
+  if (!stream)
+    return;
+
+  misc_deregister(&stream_dev);
+  for_each_possible_cpu(cpu) {
+    irq_work_sync(per_cpu_ptr(&stream_irq_work, cpu));
+    vfree(per_cpu(stream_rings, cpu).hdr);
+    per_cpu(stream_rings, cpu).hdr = NULL;
+  }
+}
+
+static int stream_init(struct dentry *dir)
+{
+  u32 size = roundup_pow_of_two(max(stream_events, 64U));
+  int cpu, retval;
+
+  if (!stream)
+    return 0;
+
+  stream_mask = size - 1;
+  stream_ring_bytes = PAGE_SIZE + PAGE_ALIGN(size * sizeof(struct kt_event));
+
+  for_each_possible_cpu(cpu) {
+    struct stream_ring *r = per_cpu_ptr(&stream_rings, cpu);
+
+    init_irq_work(per_cpu_ptr(&stream_irq_work, cpu), stream_wake);
+
+    /* zeroed and safe to hand to userspace */
+    r->hdr = vmalloc_user(stream_ring_bytes);
+    if (!r->hdr) {
+      retval = -ENOMEM;
+      goto out_free;
+    }
+    r->hdr->ring_events = size;
+    r->hdr->event_size = sizeof(struct kt_event);
+    r->ev = (struct kt_event *)((char *)r->hdr + PAGE_SIZE);
+    r->head = 0;
+  }
+
+  retval = misc_register(&stream_dev);
+  if (retval)
+    goto out_free;
+  return 0;
+
+out_free:
+  for_each_possible_cpu(cpu) {
+    vfree(per_cpu(stream_rings, cpu).hdr);
+    per_cpu(stream_rings, cpu).hdr = NULL;
+  }
+  return retval;
+}
+
+const struct kt_feature stream_feature = {
+  .name = "stream",
+  .init = stream_init,
+  .exit = stream_exit,
+};
@@ -0,0 +1,304 @@
+/*
+ * URB latency tracing: time from usb_submit_urb() to usb_hcd_giveback_urb()
+ * for URBs whose completion handler lives in the target driver, i.e. the
+ * time an URB spends queued on the host controller and the bus.
+ */
+
+#include<linux/kernel.h>
+#include<linux/module.h>
+#include<linux/kprobes.h>
+#include<linux/usb.h>
+#include<linux/hash.h>
+#include<linux/percpu.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/slab.h>
+
+#include "kprobe_test.h"
+
+/*
+ * In-flight URBs, open addressing keyed by the URB pointer. Slots are
+ * claimed and released with cmpxchg only, so submit and giveback can race
+ * on any CPU without a lock. Released slots become tombstones to keep probe
+ * chains intact; a bounded probe length keeps the handlers O(1).
+ */
+#define URB_TABLE_BITS 10
+#define URB_TABLE_SIZE (1 << URB_TABLE_BITS)
+#define URB_MAX_PROBE  16
+
+#define URB_SLOT_EMPTY 0UL
+#define URB_SLOT_TOMB  1UL
+
+struct urb_slot {
+  unsigned long urb;
+  u64 ts;
+};
+
+static struct urb_slot urb_table[URB_TABLE_SIZE];
+
+/* endpoint number plus direction bit */
+#define URB_EP_NR 32
+
+struct urb_ep_stats {
+  struct kt_hist lat;
+  struct kt_hist size;
+  u64 errors;
+};
+
+struct urb_cpu_stats {
+  struct urb_ep_stats ep[URB_EP_NR];
+  u64 table_full;
+  u64 unmatched;
+};
+
+static struct urb_cpu_stats __percpu *urb_stats;
+
+/* set while armed, the probes are gone before the module can go away */
+static struct module *urb_owner;
+
+static __always_inline unsigned int urb_ep_index(const struct urb *urb)
+{
+  return usb_pipeendpoint(urb->pipe) | (usb_pipein(urb->pipe) ? 0x10 : 0);
+}
+
+static __always_inline int urb_is_traced(const struct urb *urb)
+{
+  struct module *owner = READ_ONCE(urb_owner);
+
+  return urb && owner && within_module((unsigned long)urb->complete, owner);
+}
+
+static int urb_table_insert(const struct urb *urb, u64 ts)
+{
+  unsigned long key = (unsigned long)urb;
+  unsigned int idx = hash_ptr(urb, URB_TABLE_BITS);
+  struct urb_slot *free = NULL;
+
+  for (int i = 0; i < URB_MAX_PROBE; i++) {
+    struct urb_slot *s = &urb_table[(idx + i) & (URB_TABLE_SIZE - 1)];
+    unsigned long cur = READ_ONCE(s->urb);
+
+    /* resubmitted before we saw its giveback (or a failed submit) */
+    if (cur == key) {
+      WRITE_ONCE(s->ts, ts);
+      return 0;
+    }
+
+    /* the key may still sit past a tombstone, only the chain's end rules it out */
+    if (cur == URB_SLOT_TOMB && !free)
+      free = s;
+    if (cur == URB_SLOT_EMPTY) {
+      if (!free)
+        free = s;
+      break;
+    }
+  }
+
+  if (free) {
+    unsigned long cur = READ_ONCE(free->urb);
+
+    if ((cur == URB_SLOT_EMPTY || cur == URB_SLOT_TOMB)
+        && cmpxchg(&free->urb, cur, key) == cur) {
+      WRITE_ONCE(free->ts, ts);
+      return 0;
+    }
+  }
+
+  /* no free slot in reach, or another submit took it first */
+  return -ENOSPC;
+}
+
+static u64 urb_table_remove(const struct urb *urb)
+{
+  unsigned long key = (unsigned long)urb;
+  unsigned int idx = hash_ptr(urb, URB_TABLE_BITS);
+
+  for (int i = 0; i < URB_MAX_PROBE; i++) {
+    struct urb_slot *s = &urb_table[(idx + i) & (URB_TABLE_SIZE - 1)];
+    unsigned long cur = smp_load_acquire(&s->urb);
+    u64 ts;
+
+    if (cur == URB_SLOT_EMPTY)
+      break;
+    if (cur != key)
+      continue;
+
+    /*
+     * Tombstones are left with a zero ts, so a slot just claimed whose
+     * submitter has not stored its ts yet reads as a miss, never as the
+     * previous owner's time. Nothing else writes ts while we own the key:
+     * the URB is only resubmitted after its giveback.
+     */
+    ts = READ_ONCE(s->ts);
+    WRITE_ONCE(s->ts, 0);
+    if (cmpxchg(&s->urb, key, URB_SLOT_TOMB) != key)
+      break;
+    return ts;
+  }
+
+  return 0;
+}
+
+static int urb_submit_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  struct urb *urb = (struct urb *)regs_get_kernel_argument(regs, 0);
+
+  if (!urb_is_traced(urb))
+    return 1;
+
+  /* stamp before the HCD sees it, giveback may beat our return handler */
+  if (urb_table_insert(urb, kt_now())) {
+    this_cpu_inc(urb_stats->table_full);
+    return 1;
+  }
+
+  *(struct urb **)ri->data = urb;
+  return 0;
+}
+
+static int urb_submit_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+  /* never queued, so there will be no giveback */
+  if (regs_return_value(regs))
+    urb_table_remove(*(struct urb **)ri->data);
+  return 0;
+}
+
+static int pre_handler_giveback(struct kprobe *kp, struct pt_regs *regs)
+{
+  struct urb *urb = (struct urb *)regs_get_kernel_argument(regs, 1);
+  int status = (int)regs_get_kernel_argument(regs, 2);
+  struct urb_cpu_stats *stats;
+  struct urb_ep_stats *ep;
+  u64 ts, now = kt_now();
+
+  if (!urb_is_traced(urb))
+    return 0;
+
+  stats = this_cpu_ptr(urb_stats);
+  ts = urb_table_remove(urb);
+  if (!ts) {
+    stats->unmatched++;
+    return 0;
+  }
+
+  ep = &stats->ep[urb_ep_index(urb)];
+  if (status) {
+    /* unlinks on close/disconnect would only pollute the latencies */
+    ep->errors++;
+    return 0;
+  }
+
+  kt_hist_add(&ep->lat, now > ts ? now - ts : 0);
+  kt_hist_add(&ep->size, urb->actual_length);
+  return 0;
+}
+
+static struct kretprobe krp_submit;
+static struct kprobe kp_giveback;
+
+static int urb_trace_arm(struct module *mod)
+{
+  int retval;
+
+  memset(urb_table, 0, sizeof(urb_table));
+  WRITE_ONCE(urb_owner, mod);
+
+  memset(&krp_submit, 0, sizeof(krp_submit));
+  krp_submit.kp.symbol_name = "usb_submit_urb";
+  krp_submit.entry_handler = urb_submit_entry;
+  krp_submit.handler = urb_submit_ret;
+  krp_submit.data_size = sizeof(struct urb *);
+  retval = register_kretprobe(&krp_submit);
+  if (retval < 0) {
+    pr_err("Kretprobe registration for usb_submit_urb failed. Error number: %d",
+           retval);
+    goto out_owner;
+  }
+
+  memset(&kp_giveback, 0, sizeof(kp_giveback));
+  kp_giveback.symbol_name = "usb_hcd_giveback_urb";
+  kp_giveback.pre_handler = pre_handler_giveback;
+  retval = register_kprobe(&kp_giveback);
+  if (retval < 0) {
+    pr_err("Kprobe registration for usb_hcd_giveback_urb failed. Error number: %d",
+           retval);
+    unregister_kretprobe(&krp_submit);
+    goto out_owner;
+  }
+
+  return 0;
+
+out_owner:
+  WRITE_ONCE(urb_owner, NULL);
+  return retval;
+}
+
+static void urb_trace_disarm(void)
+{
+  unregister_kprobe(&kp_giveback);
+  unregister_kretprobe(&krp_submit);
+  WRITE_ONCE(urb_owner, NULL);
+}
+
+static int urb_latency_show(struct seq_file *m, void *v)
+{
+  struct urb_ep_stats *sum;
+  u64 table_full = 0, unmatched = 0;
+  int cpu;
+
+  sum = kcalloc(URB_EP_NR, sizeof(*sum), GFP_KERNEL);
+  if (!sum)
+    return -ENOMEM;
+
+  for_each_possible_cpu(cpu) {
+    struct urb_cpu_stats *stats = per_cpu_ptr(urb_stats, cpu);
+
+    for (int i = 0; i < URB_EP_NR; i++) {
+      kt_hist_merge(&sum[i].lat, &stats->ep[i].lat);
+      kt_hist_merge(&sum[i].size, &stats->ep[i].size);
+      sum[i].errors += stats->ep[i].errors;
+    }
+    table_full += stats->table_full;
+    unmatched += stats->unmatched;
+  }
+
+  seq_printf(m, "owner %s, table full %llu, unmatched %llu\n",
+             target, table_full, unmatched);
+
+  for (int i = 0; i < URB_EP_NR; i++) {
+    if (!sum[i].lat.count && !sum[i].errors)
+      continue;
+    seq_printf(m, "\nep 0x%02x %s, errors %llu\n", (i & 0xf) | (i & 0x10 ? 0x80 : 0),
+               i & 0x10 ? "in" : "out", sum[i].errors);
+    kt_hist_show(m, "submit->giveback", "ns", &sum[i].lat);
+    kt_hist_show(m, "transfer size", "bytes", &sum[i].size);
+  }
+
+  kfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(urb_latency);
+
+static int urb_trace_init(struct dentry *dir)
+{
+  urb_stats = alloc_percpu(struct urb_cpu_stats);
+  if (!urb_stats)
+    return -ENOMEM;
+
+  debugfs_create_file("urb_latency", 0444, dir, NULL, &urb_latency_fops);
+  return 0;
+}
+
+static void urb_trace_exit(void)
+{
+  free_percpu(urb_stats);
+}
+
+const struct kt_feature urb_trace_feature = {
+  .name = "urb_trace",
+  .init = urb_trace_init,
+  .exit = urb_trace_exit,
+  .arm = urb_trace_arm,
+  .disarm = urb_trace_disarm,
+};
@@ -0,0 +1,730 @@
+/*
+ * ktstat: drains the kprobe_test event rings (/dev/kprobe_test, module
+ * loaded with stream=1) and prints live rates, latency percentiles and a
+ * per-process breakdown. Optionally writes every record to a binary trace
+ * file, which -r reads back for offline analysis.
+ *
+ * Each CPU ring is mapped once. The loop sleeps in poll() until a ring
+ * crosses the kernel's wakeup watermark (or the report interval expires)
+ * and then consumes everything between tail and head in one go.
+ *
+ * -b runs the same loop against a producer thread in place of the kernel,
+ * so the reader's side of the stream can be checked for drops at a given
+ * rate on any machine; -c makes any lost record the exit status.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "kt_event.h"
+
+#define TRACE_MAGIC   "KTTRACE"
+#define TRACE_VERSION 1
+
+/* trace file: this header, then raw struct kt_event records */
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+};
+
+static const char *const probe_names[] = { "open", "read", "write", "close" };
+#define PROBE_NR (sizeof(probe_names) / sizeof(probe_names[0]))
+
+/*
+ * Log-linear latency histogram: values below 16 are exact, above that each
+ * power of two is split into 16 buckets, so percentiles are within ~6%.
+ */
+#define HIST_SUB    16
+#define HIST_SLOTS  (HIST_SUB + 60 * HIST_SUB)
+
+struct hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t slot[HIST_SLOTS];
+};
+
+struct probe_stats {
+    uint64_t entries;
+    uint64_t returns;
+    uint64_t bytes;
+    struct hist lat;
+};
+
+#define PROC_SLOTS 4096
+
+struct proc_stats {
+    uint32_t pid;               /* 0 marks a free slot */
+    char comm[16];
+    uint64_t calls[PROBE_NR];
+    uint64_t bytes[PROBE_NR];
+};
+
+struct stats {
+    uint64_t events;
+    uint64_t lost;
+    struct probe_stats probe[PROBE_NR];
+    struct proc_stats proc[PROC_SLOTS];
+    uint64_t procs_full;
+};
+
+struct ring {
+    struct kt_ring_header *hdr;
+    const struct kt_event *ev;
+    uint32_t mask;
+    uint64_t lost_seen;
+};
+
+static volatile sig_atomic_t signal_received = 0;
+
+static void sigint_handler(int signal)
+{
+    signal_received = signal;
+}
+
+static unsigned int hist_slot(uint64_t v)
+{
+    unsigned int e;
+
+    if (v < HIST_SUB) { return v; }
+    e = 63 - __builtin_clzll(v);
+    return HIST_SUB + (e - 4) * HIST_SUB + ((v >> (e - 4)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(unsigned int slot)
+{
+    unsigned int e;
+
+    if (slot < HIST_SUB) { return slot; }
+    e = (slot - HIST_SUB) / HIST_SUB + 4;
+    return (uint64_t)(HIST_SUB + slot % HIST_SUB) << (e - 4);
+}
+
+static void hist_add(struct hist *h, uint64_t v)
+{
+    h->count++;
+    if (v > h->max) { h->max = v; }
+    h->slot[hist_slot(v)]++;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double pct)
+{
+    uint64_t want = (uint64_t)(h->count * pct / 100.0), seen = 0;
+
+    for (unsigned int i = 0; i < HIST_SLOTS; i++) {
+        seen += h->slot[i];
+        if (seen > want) { return hist_value(i); }
+    }
+    return h->max;
+}
+
+static struct proc_stats *proc_get(struct stats *st, const struct kt_event *ev)
+{
+    uint32_t pid = ev->pid ? ev->pid : UINT32_MAX;
+    uint32_t idx = (pid * 2654435761u) & (PROC_SLOTS - 1);
+
+    for (uint32_t i = 0; i < PROC_SLOTS; i++) {
+        struct proc_stats *p = &st->proc[(idx + i) & (PROC_SLOTS - 1)];
+
+        if (p->pid == pid) { return p; }
+        if (!p->pid) {
+            p->pid = pid;
+            if (ev->pid) { memcpy(p->comm, ev->comm, sizeof(p->comm)); }
+            else { strcpy(p->comm, "[irq]"); }
+            return p;
+        }
+    }
+    st->procs_full++;
+    return NULL;
+}
+
+static void account(struct stats *st, const struct kt_event *ev)
+{
+    struct probe_stats *ps;
+    struct proc_stats *p;
+
+    st->events++;
+    if (ev->probe >= PROBE_NR) { return; }
+    ps = &st->probe[ev->probe];
+
+    if (ev->type == KT_EV_RETURN) {
+        ps->returns++;
+        hist_add(&ps->lat, ev->val);
+        return;
+    }
+
+    /* bytes are what the entry asked for, or the URB transferred */
+    ps->entries++;
+    ps->bytes += ev->len;
+    p = proc_get(st, ev);
+    if (p) {
+        p->calls[ev->probe]++;
+        p->bytes[ev->probe] += ev->len;
+    }
+}
+
+static int proc_cmp(const void *a, const void *b)
+{
+    const struct proc_stats *pa = a, *pb = b;
+    uint64_t ca = 0, cb = 0;
+
+    for (size_t i = 0; i < PROBE_NR; i++) {
+        ca += pa->calls[i];
+        cb += pb->calls[i];
+    }
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static void report(struct stats *st, double secs, int top)
+{
+    static struct proc_stats procs[PROC_SLOTS];
+    size_t nr = 0;
+
+    printf("\n%.2f s: %llu events (%.0f/s), %llu lost\n", secs,
+           (unsigned long long)st->events, secs > 0 ? st->events / secs : 0.0,
+           (unsigned long long)st->lost);
+    printf("%-6s %10s %10s %12s %10s %10s %10s %10s %10s\n", "probe", "calls/s",
+           "bytes/s", "returns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+
+    for (size_t i = 0; i < PROBE_NR; i++) {
+        const struct probe_stats *ps = &st->probe[i];
+
+        if (!ps->entries && !ps->returns) { continue; }
+        printf("%-6s %10.0f %10.0f %12llu %10llu %10llu %10llu %10llu %10llu\n",
+               probe_names[i], secs > 0 ? ps->entries / secs : 0.0,
+               secs > 0 ? ps->bytes / secs : 0.0,
+               (unsigned long long)ps->returns,
+               (unsigned long long)hist_percentile(&ps->lat, 50),
+               (unsigned long long)hist_percentile(&ps->lat, 90),
+               (unsigned long long)hist_percentile(&ps->lat, 99),
+               (unsigned long long)hist_percentile(&ps->lat, 99.9),
+               (unsigned long long)ps->lat.max);
+    }
+
+    for (size_t i = 0; i < PROC_SLOTS; i++) {
+        if (st->proc[i].pid) { procs[nr++] = st->proc[i]; }
+    }
+    if (!nr) { return; }
+    qsort(procs, nr, sizeof(procs[0]), proc_cmp);
+
+    printf("%-8s %-16s %10s %10s %10s %10s %12s %12s\n", "pid", "comm", "open",
+           "read", "write", "close", "read_bytes", "write_bytes");
+    for (size_t i = 0; i < nr && (int)i < top; i++) {
+        const struct proc_stats *p = &procs[i];
+
+        printf("%-8d %-16.16s %10llu %10llu %10llu %10llu %12llu %12llu\n",
+               p->pid == UINT32_MAX ? 0 : (int)p->pid, p->comm,
+               (unsigned long long)p->calls[0], (unsigned long long)p->calls[1],
+               (unsigned long long)p->calls[2], (unsigned long long)p->calls[3],
+               (unsigned long long)p->bytes[1], (unsigned long long)p->bytes[2]);
+    }
+    if (st->procs_full) {
+        printf("process table full, %llu events not attributed\n",
+               (unsigned long long)st->procs_full);
+    }
+}
+
+/*
+ * Records are copied into 1 MB buffers that a writer thread hands to the
+ * file, so a write() held up by writeback stalls the writer rather than
+ * the drain loop. The queue holds about a second at 1M records/s; only a
+ * disk slower than the event rate for longer blocks the reader again.
+ */
+#define TRACE_BUF   (1 << 20)
+#define TRACE_BUFS  64
+
+struct trace {
+    int fd;
+    int failed;
+    int closing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t fill;              /* buffer being filled */
+    uint32_t queued;            /* full buffers waiting, the oldest first */
+    size_t len[TRACE_BUFS];
+    char (*buf)[TRACE_BUF];
+};
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    size_t off = 0;
+
+    while (off < len) {
+        ssize_t n = write(fd, data + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+static void *trace_writer(void *arg)
+{
+    struct trace *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        uint32_t idx;
+
+        while (!t->queued && !t->closing) { pthread_cond_wait(&t->cond, &t->lock); }
+        if (!t->queued) { break; }
+        idx = (t->fill + TRACE_BUFS - t->queued) % TRACE_BUFS;
+        pthread_mutex_unlock(&t->lock);
+
+        if (!t->failed && write_all(t->fd, t->buf[idx], t->len[idx])) {
+            perror("Failed to write trace");
+            t->failed = 1;
+        }
+
+        pthread_mutex_lock(&t->lock);
+        t->queued--;
+        pthread_cond_broadcast(&t->cond);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/* queues the buffer being filled, waits for a free one when all are full */
+static void trace_submit(struct trace *t)
+{
+    pthread_mutex_lock(&t->lock);
+    t->queued++;
+    pthread_cond_broadcast(&t->cond);
+    while (t->queued == TRACE_BUFS) { pthread_cond_wait(&t->cond, &t->lock); }
+    t->fill = (t->fill + 1) % TRACE_BUFS;
+    t->len[t->fill] = 0;
+    pthread_mutex_unlock(&t->lock);
+}
+
+static int trace_append(struct trace *t, const void *data, size_t len)
+{
+    while (len) {
+        size_t *used = &t->len[t->fill];
+        size_t n = len < TRACE_BUF - *used ? len : TRACE_BUF - *used;
+
+        memcpy(t->buf[t->fill] + *used, data, n);
+        *used += n;
+        data = (const char *)data + n;
+        len -= n;
+        if (*used == TRACE_BUF) { trace_submit(t); }
+    }
+    return t->failed ? -1 : 0;
+}
+
+static struct trace *trace_create(const char *path)
+{
+    struct trace_header hdr = { .version = TRACE_VERSION,
+                                .event_size = sizeof(struct kt_event) };
+    struct trace *t = calloc(1, sizeof(*t));
+
+    if (!t) { return NULL; }
+    t->buf = malloc(sizeof(*t->buf) * TRACE_BUFS);
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!t->buf || t->fd < 0) {
+        if (t->fd >= 0) { close(t->fd); }
+        free(t->buf);
+        free(t);
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    if (pthread_create(&t->thread, NULL, trace_writer, t)) {
+        close(t->fd);
+        free(t->buf);
+        free(t);
+        return NULL;
+    }
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    trace_append(t, &hdr, sizeof(hdr));
+    return t;
+}
+
+static void trace_close(struct trace *t)
+{
+    if (!t) { return; }
+
+    pthread_mutex_lock(&t->lock);
+    if (t->len[t->fill]) {
+        t->queued++;
+        t->fill = (t->fill + 1) % TRACE_BUFS;
+    }
+    t->closing = 1;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+
+    close(t->fd);
+    free(t->buf);
+    free(t);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* consume everything the kernel published in one ring */
+static void drain(struct ring *r, struct stats *st, struct trace *t)
+{
+    uint64_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->hdr->tail, lost;
+
+    while (tail != head) {
+        uint32_t first = tail & r->mask;
+        uint64_t n = head - tail;
+
+        /* up to the end of the ring, the rest on the next pass */
+        if (n > r->mask + 1 - first) { n = r->mask + 1 - first; }
+
+        for (uint64_t i = 0; i < n; i++) { account(st, &r->ev[first + i]); }
+        if (t && trace_append(t, &r->ev[first], n * sizeof(struct kt_event))) {
+            perror("Failed to write trace");
+        }
+        tail += n;
+    }
+
+    __atomic_store_n(&r->hdr->tail, tail, __ATOMIC_RELEASE);
+
+    lost = __atomic_load_n(&r->hdr->lost, __ATOMIC_RELAXED);
+    st->lost += lost - r->lost_seen;
+    r->lost_seen = lost;
+}
+
+struct run_opts {
+    double interval;
+    double duration;            /* 0 runs until interrupted */
+    int top;
+    uint64_t lost;              /* over the whole run */
+};
+
+/* what stream_poll() checks, an eventfd only says the watermark was crossed */
+static int rings_ready(const struct ring *rings, uint32_t nr)
+{
+    for (uint32_t cpu = 0; cpu < nr; cpu++) {
+        if (__atomic_load_n(&rings[cpu].hdr->head, __ATOMIC_ACQUIRE)
+            != rings[cpu].hdr->tail) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sleeps on fd and drains every ring whenever it is ready or a quarter of
+ * the interval passed. The device is ready for as long as a ring holds
+ * records; an eventfd standing in for it is not, so with one the rings
+ * are checked the same way first, and it has to be read to rearm.
+ */
+static void run_rings(int fd, int is_eventfd, struct ring *rings, uint32_t nr,
+                      struct stats *st, struct run_opts *opts, struct trace *t)
+{
+    double start, last;
+
+    start = last = now_sec();
+    while (!signal_received) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int timeout = (int)(opts->interval * 1000 / 4);
+        double now;
+
+        if (is_eventfd && rings_ready(rings, nr)) { timeout = 0; }
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (is_eventfd && pfd.revents & POLLIN) {
+            uint64_t count;
+            if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) { perror("read"); }
+        }
+
+        for (uint32_t cpu = 0; cpu < nr; cpu++) {
+            drain(&rings[cpu], st, t);
+        }
+
+        now = now_sec();
+        if (opts->duration > 0 && now - start >= opts->duration) { break; }
+        if (now - last >= opts->interval) {
+            report(st, now - last, opts->top);
+            fflush(stdout);
+            opts->lost += st->lost;
+            memset(st, 0, sizeof(*st));
+            last = now;
+        }
+    }
+
+    for (uint32_t cpu = 0; cpu < nr; cpu++) {
+        drain(&rings[cpu], st, t);
+    }
+    report(st, now_sec() - last, opts->top);
+    opts->lost += st->lost;
+    printf("ran for %.1f s, %llu lost in total\n", now_sec() - start,
+           (unsigned long long)opts->lost);
+}
+
+static int run_live(const char *dev, struct run_opts *opts, struct trace *t)
+{
+    struct kt_stream_info info;
+    struct stats *st = calloc(1, sizeof(*st));
+    struct ring *rings;
+    int fd;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        perror("Error opening event device");
+        return -1;
+    }
+    if (ioctl(fd, KT_IOC_INFO, &info) < 0) {
+        perror("Failed to query the event rings");
+        return -1;
+    }
+    if (info.event_size != sizeof(struct kt_event)) {
+        fprintf(stderr, "Event size mismatch: kernel %u, ktstat %zu\n",
+                info.event_size, sizeof(struct kt_event));
+        return -1;
+    }
+
+    rings = calloc(info.nr_cpus, sizeof(*rings));
+    if (!st || !rings) { return -1; }
+
+    for (uint32_t cpu = 0; cpu < info.nr_cpus; cpu++) {
+        void *map = mmap(NULL, info.ring_bytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, (off_t)cpu * info.ring_bytes);
+        if (map == MAP_FAILED) {
+            perror("Failed to map an event ring");
+            return -1;
+        }
+        rings[cpu].hdr = map;
+        rings[cpu].ev = (const struct kt_event *)((char *)map + info.header_size);
+        rings[cpu].mask = info.ring_events - 1;
+        rings[cpu].lost_seen = rings[cpu].hdr->lost;
+        /* skip whatever piled up before we attached */
+        rings[cpu].hdr->tail = rings[cpu].hdr->head;
+    }
+
+    printf("ktstat: %u rings of %u events, reporting every %.1f s\n",
+           info.nr_cpus, info.ring_events, opts->interval);
+
+    run_rings(fd, 0, rings, info.nr_cpus, st, opts, t);
+    close(fd);
+    return 0;
+}
+
+/* the module's stream_events and stream_wakeup defaults */
+#define BENCH_RING_EVENTS 16384
+#define BENCH_WAKEUP      64
+
+struct bench_producer {
+    struct ring *ring;
+    int efd;
+    double rate;                /* records per second */
+    int stop;
+    uint64_t sent;              /* pushed or dropped, once stopped */
+};
+
+/*
+ * Pushes like kt_ring_push() does, at rate records per second, and signals
+ * the eventfd where stream.c queues its wakeup. Records alternate entry
+ * and return so the reader does all of its accounting work. What is due
+ * goes out in a burst every 100 us, in between the thread sleeps rather
+ * than spin on a core the reader may need.
+ */
+static void *bench_produce(void *arg)
+{
+    struct bench_producer *p = arg;
+    struct kt_ring_header *hdr = p->ring->hdr;
+    struct kt_event *ring = (struct kt_event *)p->ring->ev;
+    struct kt_event ev = { .pid = getpid(), .len = 64, .tty = 0, .probe = 2 };
+    uint64_t head = 0, sent = 0;
+    double start = now_sec();
+
+    strcpy(ev.comm, "ktstat-bench");
+    while (!__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) {
+        double now = now_sec();
+        uint64_t due = (uint64_t)((now - start) * p->rate);
+
+        for (; sent < due; sent++) {
+            uint64_t used = head - __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+
+            if (used > p->ring->mask) {
+                __atomic_store_n(&hdr->lost, hdr->lost + 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            ev.ts = (uint64_t)(now * 1e9);
+            ev.type = sent & 1 ? KT_EV_RETURN : KT_EV_ENTRY;
+            ev.val = sent & 1 ? 1000 + sent % 4096 : 0;
+            ring[head & p->ring->mask] = ev;
+            __atomic_store_n(&hdr->head, ++head, __ATOMIC_RELEASE);
+
+            if (used + 1 == BENCH_WAKEUP) {
+                uint64_t one = 1;
+                if (write(p->efd, &one, sizeof(one)) < 0) { perror("write"); }
+            }
+        }
+        nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+    }
+    p->sent = sent;
+    return NULL;
+}
+
+static int run_bench(double rate, struct run_opts *opts, struct trace *t)
+{
+    size_t header_size = 4096;
+    struct stats *st = calloc(1, sizeof(*st));
+    struct bench_producer p = { .rate = rate };
+    struct ring ring = { .mask = BENCH_RING_EVENTS - 1 };
+    pthread_t thread;
+    void *mem;
+
+    mem = aligned_alloc(header_size, header_size
+                        + BENCH_RING_EVENTS * sizeof(struct kt_event));
+    p.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!st || !mem || p.efd < 0) {
+        perror("Failed to set up the benchmark ring");
+        return -1;
+    }
+    memset(mem, 0, header_size);
+    ring.hdr = mem;
+    ring.ev = (const struct kt_event *)((char *)mem + header_size);
+    p.ring = &ring;
+
+    printf("ktstat: benchmark ring of %u events, %.0f records/s, reporting every %.1f s\n",
+           BENCH_RING_EVENTS, rate, opts->interval);
+
+    if (pthread_create(&thread, NULL, bench_produce, &p)) {
+        perror("Failed to start the producer");
+        return -1;
+    }
+    run_rings(p.efd, 1, &ring, 1, st, opts, t);
+    __atomic_store_n(&p.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+
+    /* what the producer pushed or dropped after the final drain */
+    memset(st, 0, sizeof(*st));
+    drain(&ring, st, t);
+    opts->lost += st->lost;
+    printf("producer stopped after %llu records, %llu lost in total\n",
+           (unsigned long long)p.sent, (unsigned long long)opts->lost);
+
+    close(p.efd);
+    free(mem);
+    free(st);
+    return 0;
+}
+
+static int run_offline(const char *path, int top)
+{
+    static struct kt_event buf[8192];
+    struct trace_header hdr;
+    struct stats *st = calloc(1, sizeof(*st));
+    uint64_t first_ts = 0, last_ts = 0;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || !st) {
+        perror("Error opening trace");
+        return -1;
+    }
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || memcmp(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC))
+        || hdr.version != TRACE_VERSION
+        || hdr.event_size != sizeof(struct kt_event)) {
+        fprintf(stderr, "%s is not a ktstat trace\n", path);
+        return -1;
+    }
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        size_t nr = n / sizeof(buf[0]);
+
+        for (size_t i = 0; i < nr; i++) {
+            /* records come per CPU batch, not globally sorted */
+            if (!first_ts || buf[i].ts < first_ts) { first_ts = buf[i].ts; }
+            if (buf[i].ts > last_ts) { last_ts = buf[i].ts; }
+            account(st, &buf[i]);
+        }
+    }
+
+    report(st, (last_ts - first_ts) / 1e9, top);
+    close(fd);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d device] [-i seconds] [-t seconds] [-c] [-n top] [-w trace]\n"
+            "       %s -b rate [-i seconds] [-t seconds] [-c] [-n top] [-w trace]\n"
+            "       %s -r trace [-n top]\n"
+            "  -d  event device (default /dev/kprobe_test)\n"
+            "  -i  report interval (default 1)\n"
+            "  -t  stop after this long (default: on SIGINT)\n"
+            "  -c  exit with status 2 if any record was lost\n"
+            "  -b  read from a producer thread pushing rate records/s instead\n"
+            "  -n  processes shown per report (default 10)\n"
+            "  -w  also write every record to a binary trace file\n"
+            "  -r  report on a trace file instead of the live rings\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev = "/dev/kprobe_test", *out = NULL, *in = NULL;
+    struct run_opts opts = { .interval = 1.0, .top = 10 };
+    struct trace *t = NULL;
+    double rate = 0;
+    int check = 0, opt, ret;
+
+    while ((opt = getopt(argc, argv, "d:i:t:cb:n:w:r:h")) != -1) {
+        switch (opt) {
+        case 'd': dev = optarg; break;
+        case 'i': opts.interval = atof(optarg); break;
+        case 't': opts.duration = atof(optarg); break;
+        case 'c': check = 1; break;
+        case 'b': rate = atof(optarg); break;
+        case 'n': opts.top = atoi(optarg); break;
+        case 'w': out = optarg; break;
+        case 'r': in = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.interval <= 0) { opts.interval = 1.0; }
+
+    if (in) { return run_offline(in, opts.top) ? 1 : 0; }
+
+    if (out) {
+        t = trace_create(out);
+        if (!t) {
+            perror("Failed to create trace");
+            return 1;
+        }
+    }
+
+    signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);
+
+    ret = rate > 0 ? run_bench(rate, &opts, t) : run_live(dev, &opts, t);
+    trace_close(t);
+    if (ret) { return 1; }
+    return check && opts.lost ? 2 : 0;
+}
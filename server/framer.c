@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "framer.h"
+
+#define FRAMER_MASK (FRAMER_SIZE - 1)
+
+void framer_init(struct framer *framer)
+{
+    memset(framer, 0, sizeof(*framer));
+}
+
+/* a raw port hands over whatever the host's Enter sends, '\r' included */
+static const char *line_end(const char *data, size_t len)
+{
+    const char *newline = memchr(data, '\n', len);
+    const char *ret = memchr(data, '\r', newline ? (size_t)(newline - data) : len);
+
+    return ret ? ret : newline;
+}
+
+static uint32_t framer_used(const struct framer *framer)
+{
+    return framer->head - framer->tail;
+}
+
+size_t framer_push(struct framer *framer, const char *data, size_t len)
+{
+    size_t taken = 0;
+
+    while (taken < len) {
+        if (framer->discarding) {
+            const char *newline = line_end(data + taken, len - taken);
+            if (!newline) { return len; }
+
+            taken = newline + 1 - data;
+            framer->discarding = 0;
+            continue;
+        }
+
+        if (framer_used(framer) == FRAMER_SIZE) {
+            /* framer_next() went through all of it, no line ends in there */
+            if (framer->scanned != FRAMER_SIZE) { break; }
+
+            framer->tail = framer->head;
+            framer->scanned = 0;
+            framer->discarding = 1;
+            framer->dropped++;
+            continue;
+        }
+
+        /* up to the end of the ring or of the free space, whichever first */
+        uint32_t offset = framer->head & FRAMER_MASK;
+        size_t chunk = FRAMER_SIZE - offset;
+        if (chunk > FRAMER_SIZE - framer_used(framer)) {
+            chunk = FRAMER_SIZE - framer_used(framer);
+        }
+        if (chunk > len - taken) { chunk = len - taken; }
+
+        memcpy(framer->ring + offset, data + taken, chunk);
+        framer->head += chunk;
+        taken += chunk;
+    }
+
+    return taken;
+}
+
+size_t framer_next(struct framer *framer, char *line, size_t size)
+{
+    uint32_t used = framer_used(framer);
+
+    /* only look at what arrived since the last call */
+    while (framer->scanned < used) {
+        uint32_t offset = (framer->tail + framer->scanned) & FRAMER_MASK;
+        size_t chunk = FRAMER_SIZE - offset;
+        if (chunk > used - framer->scanned) { chunk = used - framer->scanned; }
+
+        const char *newline = line_end(framer->ring + offset, chunk);
+        if (!newline) {
+            framer->scanned += chunk;
+            continue;
+        }
+
+        size_t len = framer->scanned + (newline - (framer->ring + offset)) + 1;
+        size_t copy = len < size ? len : (size ? size - 1 : 0);
+
+        for (size_t i = 0; i < copy; i++) {
+            line[i] = framer->ring[(framer->tail + i) & FRAMER_MASK];
+        }
+        if (size) { line[copy] = '\0'; }
+
+        framer->tail += len;
+        framer->scanned = 0;
+        return len;
+    }
+
+    return 0;
+}
+
+size_t framer_peek(const struct framer *framer, void *buf, size_t size)
+{
+    uint32_t used = framer_used(framer);
+    char *out = buf;
+
+    if (size > used) { size = used; }
+    for (size_t i = 0; i < size; i++) {
+        out[i] = framer->ring[(framer->tail + i) & FRAMER_MASK];
+    }
+    return size;
+}
+
+void framer_skip(struct framer *framer, size_t len)
+{
+    if (len > framer_used(framer)) { len = framer_used(framer); }
+    framer->tail += len;
+    framer->scanned = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* longest command line kept, newline included; a power of 2 */
+#define FRAMER_SIZE 512
+
+/*
+ * Splits the serial byte stream into lines ending in '\n' or '\r'. Reads go in
+ * with framer_push() whatever their boundaries, complete lines come out
+ * of framer_next() one by one and a partial tail waits for the next read:
+ *
+ *     while (len) {
+ *         taken = framer_push(&framer, data, len);
+ *         data += taken;
+ *         len -= taken;
+ *         while (framer_next(&framer, line, sizeof(line))) { ... }
+ *     }
+ */
+struct framer {
+    char ring[FRAMER_SIZE];
+    uint32_t head;          /* free running, masked on access */
+    uint32_t tail;
+    uint32_t scanned;       /* bytes past tail known to hold no newline */
+    int32_t discarding;     /* an overlong line is dropped up to its newline */
+    uint32_t dropped;       /* overlong lines dropped so far */
+};
+
+void framer_init(struct framer *framer);
+
+/*
+ * Buffers as much of data as fits and returns how much that was. When
+ * the ring is full of complete lines it takes nothing until framer_next()
+ * made room; a line longer than the ring is dropped up to its newline.
+ */
+size_t framer_push(struct framer *framer, const char *data, size_t len);
+
+/*
+ * Copies the next complete line, newline included, NUL terminated, into
+ * line and returns its length; 0 when no complete line is buffered.
+ */
+size_t framer_next(struct framer *framer, char *line, size_t size);
+
+/* copies up to size buffered bytes without consuming them, returns how many */
+size_t framer_peek(const struct framer *framer, void *buf, size_t size);
+
+/* consumes len buffered bytes, for binary frames measured with framer_peek() */
+void framer_skip(struct framer *framer, size_t len);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gpio.h"
+
+/* the first one is the default */
+static const struct gpio_backend *const backends[] = {
+#ifdef GPIO_PIGPIO
+    &gpio_pigpio_backend,
+#endif
+    &gpio_chip_backend,
+    &gpio_sim_backend,
+};
+
+static const struct gpio_backend *backend;
+
+/*
+ * The level last written to each pin, for the pins in known. Writes that
+ * would not change a known pin never reach the backend; a pin leaves
+ * known when it becomes an input or a write to it fails.
+ */
+static uint32_t shadow;
+static uint32_t known;
+
+int32_t gpio_init(const char *spec)
+{
+    size_t len = spec ? strcspn(spec, ":") : 0;
+    const char *arg = spec && spec[len] ? spec + len + 1 : NULL;
+
+    for (uint32_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (spec && (strlen(backends[i]->name) != len
+                     || strncmp(backends[i]->name, spec, len))) {
+            continue;
+        }
+        if (backends[i]->init(arg) < 0) { return -1; }
+        backend = backends[i];
+        shadow = known = 0;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown GPIO backend %s, have: %s\n", spec, gpio_backends());
+    return -1;
+}
+
+void gpio_exit(void)
+{
+    if (backend) { backend->exit(); }
+    backend = NULL;
+}
+
+const char *gpio_backends(void)
+{
+    static char names[64];
+
+    if (!names[0]) {
+        for (uint32_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+            if (i) { strcat(names, " "); }
+            strcat(names, backends[i]->name);
+        }
+    }
+    return names;
+}
+
+int32_t gpio_output(uint32_t pin)
+{
+    return pin > GPIO_MAX_PIN ? -1 : backend->output(pin);
+}
+
+int32_t gpio_input(uint32_t pin)
+{
+    if (pin > GPIO_MAX_PIN) { return -1; }
+    known &= ~(1u << pin);
+    return backend->input(pin);
+}
+
+int32_t gpio_write(uint32_t pin, uint32_t level)
+{
+    uint32_t bit;
+
+    if (pin > GPIO_MAX_PIN) { return -1; }
+    bit = 1u << pin;
+    if (known & bit && !(shadow & bit) == !level) { return 0; }
+
+    if (backend->write(pin, !!level) < 0) {
+        known &= ~bit;
+        return -1;
+    }
+    shadow = level ? shadow | bit : shadow & ~bit;
+    known |= bit;
+    return 0;
+}
+
+int32_t gpio_write_mask(uint32_t mask, uint32_t values)
+{
+    /* only the pins that are unknown or would change */
+    mask &= ~known | (shadow ^ values);
+    values &= mask;
+    if (!mask) { return 0; }
+
+    if (backend->write_mask(mask, values) < 0) {
+        known &= ~mask;
+        return -1;
+    }
+    shadow = (shadow & ~mask) | values;
+    known |= mask;
+    return 0;
+}
+
+int32_t gpio_read(uint32_t pin)
+{
+    return pin > GPIO_MAX_PIN ? -1 : backend->read(pin);
+}
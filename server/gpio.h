@@ -0,0 +1,45 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+
+/* pins the commands may name, the Pi's user GPIOs in BCM numbering */
+#define GPIO_MAX_PIN 31
+
+/*
+ * One way of driving the pins. gpio_init() picks one by name at start,
+ * the rest of the server only goes through the gpio_*() calls below.
+ * Calls return 0 or a level on success and -1 on failure.
+ *
+ * write_mask() drives every pin in mask to its bit in values in one
+ * operation, making them outputs first where needed, so the pins change
+ * together rather than one call apart.
+ */
+struct gpio_backend {
+    const char *name;
+    /* arg is the text after "name:" on the command line, or NULL */
+    int32_t (*init)(const char *arg);
+    void (*exit)(void);
+    int32_t (*output)(uint32_t pin);
+    int32_t (*input)(uint32_t pin);
+    int32_t (*write)(uint32_t pin, uint32_t level);
+    int32_t (*write_mask)(uint32_t mask, uint32_t values);
+    int32_t (*read)(uint32_t pin);
+};
+
+extern const struct gpio_backend gpio_pigpio_backend;
+extern const struct gpio_backend gpio_chip_backend;
+extern const struct gpio_backend gpio_sim_backend;
+
+/* "pigpio", "chip[:/dev/gpiochipN]" or "sim[:latency_us]", NULL for the default */
+int32_t gpio_init(const char *spec);
+void gpio_exit(void);
+const char *gpio_backends(void);
+
+int32_t gpio_output(uint32_t pin);
+int32_t gpio_input(uint32_t pin);
+int32_t gpio_write(uint32_t pin, uint32_t level);
+int32_t gpio_write_mask(uint32_t mask, uint32_t values);
+int32_t gpio_read(uint32_t pin);
+
+#endif
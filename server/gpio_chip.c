@@ -0,0 +1,237 @@
+/*
+ * The GPIO character device, uAPI v2. Every free line the commands can
+ * name is taken at init in one request, as an input, and kept until exit:
+ * a pin becomes an output or an input again by GPIO_V2_LINE_SET_CONFIG on
+ * that request, which the other lines ride through at their current
+ * direction and level, so no line is ever released and re-requested.
+ *
+ * A write, of one pin or a whole mask, is a single
+ * GPIO_V2_LINE_SET_VALUES ioctl on the request fd, with no daemon or
+ * memory mapping in between, and a read is one GET_VALUES.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+#define CHIP_DEFAULT "/dev/gpiochip0"
+#define CHIP_CONSUMER "run_server"
+
+static int32_t chip_fd = -1;
+static int32_t request_fd = -1;
+
+/* the request's line index of each pin, -1 when the chip has no such free line */
+static int32_t line_of[GPIO_MAX_PIN + 1];
+/* pins currently outputs, and the last level set on each */
+static uint32_t outputs;
+static uint32_t levels;
+
+/* the request's lines for the pins in mask */
+static uint64_t line_mask(uint32_t pins)
+{
+    uint64_t mask = 0;
+
+    for (uint32_t pin = 0; pin <= GPIO_MAX_PIN; pin++) {
+        if (pins & (1u << pin) && line_of[pin] >= 0) { mask |= 1ull << line_of[pin]; }
+    }
+    return mask;
+}
+
+static int32_t chip_has(uint32_t pins)
+{
+    for (uint32_t pin = 0; pin <= GPIO_MAX_PIN; pin++) {
+        if (pins & (1u << pin) && line_of[pin] < 0) {
+            fprintf(stderr, "GPIO line %u is not available\n", pin);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the whole request's config: outputs at levels, every other line an input */
+static int32_t chip_config(void)
+{
+    struct gpio_v2_line_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    config.num_attrs = 2;
+    config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+    config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    config.attrs[0].mask = line_mask(outputs);
+    config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[1].attr.values = line_mask(outputs & levels);
+    config.attrs[1].mask = line_mask(outputs);
+
+    if (ioctl(request_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+        perror("Failed to configure GPIO lines");
+        return -1;
+    }
+    return 0;
+}
+
+/* one input request over every free line a pin number can name */
+static int32_t chip_request(const char *path)
+{
+    struct gpiochip_info info;
+    struct gpio_v2_line_request req;
+
+    if (ioctl(chip_fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0) {
+        perror("Failed to get GPIO chip info");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    strncpy(req.consumer, CHIP_CONSUMER, sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+
+    /* lines some other consumer holds are left to it */
+    for (uint32_t pin = 0; pin <= GPIO_MAX_PIN; pin++) {
+        struct gpio_v2_line_info line = { .offset = pin };
+
+        line_of[pin] = -1;
+        if (pin >= info.lines) { continue; }
+        if (ioctl(chip_fd, GPIO_V2_GET_LINEINFO_IOCTL, &line) < 0) {
+            perror("Failed to get GPIO line info");
+            return -1;
+        }
+        if (line.flags & GPIO_V2_LINE_FLAG_USED) { continue; }
+        line_of[pin] = req.num_lines;
+        req.offsets[req.num_lines++] = pin;
+    }
+    if (!req.num_lines) {
+        fprintf(stderr, "%s: no free GPIO lines\n", path);
+        return -1;
+    }
+
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        perror("Failed to request GPIO lines");
+        return -1;
+    }
+    request_fd = req.fd;
+    return 0;
+}
+
+static int32_t chip_init(const char *arg)
+{
+    const char *path = arg ? arg : CHIP_DEFAULT;
+
+    chip_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (chip_fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (chip_request(path) < 0) {
+        close(chip_fd);
+        chip_fd = -1;
+        return -1;
+    }
+    outputs = 0;
+    levels = 0;
+    return 0;
+}
+
+/* released lines go back to whatever the chip makes of unrequested lines */
+static void chip_exit(void)
+{
+    close(request_fd);
+    request_fd = -1;
+    close(chip_fd);
+    chip_fd = -1;
+}
+
+static int32_t chip_output(uint32_t pin)
+{
+    if (!chip_has(1u << pin)) { return -1; }
+    if (outputs & (1u << pin)) { return 0; }
+
+    outputs |= 1u << pin;
+    if (chip_config() < 0) {
+        outputs &= ~(1u << pin);
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t chip_input(uint32_t pin)
+{
+    if (!chip_has(1u << pin)) { return -1; }
+    if (!(outputs & (1u << pin))) { return 0; }
+
+    outputs &= ~(1u << pin);
+    if (chip_config() < 0) {
+        outputs |= 1u << pin;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pins not outputs yet become outputs at their new levels in the one
+ * SET_CONFIG, which sets the rest of the mask with them; otherwise the
+ * mask is one SET_VALUES. On failure the pins keep the state they had.
+ */
+static int32_t chip_write_mask(uint32_t mask, uint32_t values)
+{
+    struct gpio_v2_line_values line_values = { 0 };
+    uint32_t old_outputs = outputs, old_levels = levels;
+
+    if (!chip_has(mask)) { return -1; }
+    levels = (levels & ~mask) | (values & mask);
+
+    /* like pigpio, writing a pin makes it an output */
+    if (mask & ~outputs) {
+        outputs |= mask;
+        if (chip_config() < 0) {
+            outputs = old_outputs;
+            levels = old_levels;
+            return -1;
+        }
+        return 0;
+    }
+
+    line_values.mask = line_mask(mask);
+    line_values.bits = line_mask(mask & levels);
+    if (ioctl(request_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &line_values) < 0) {
+        perror("Failed to set GPIO lines");
+        levels = old_levels;
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t chip_write(uint32_t pin, uint32_t level)
+{
+    return chip_write_mask(1u << pin, level ? 1u << pin : 0);
+}
+
+/* inputs and outputs alike are lines of the request */
+static int32_t chip_read(uint32_t pin)
+{
+    struct gpio_v2_line_values values = { 0 };
+
+    if (!chip_has(1u << pin)) { return -1; }
+
+    values.mask = line_mask(1u << pin);
+    if (ioctl(request_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        perror("Failed to read GPIO line");
+        return -1;
+    }
+    return !!(values.bits & values.mask);
+}
+
+const struct gpio_backend gpio_chip_backend = {
+    .name = "chip",
+    .init = chip_init,
+    .exit = chip_exit,
+    .output = chip_output,
+    .input = chip_input,
+    .write = chip_write,
+    .write_mask = chip_write_mask,
+    .read = chip_read,
+};
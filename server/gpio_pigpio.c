@@ -0,0 +1,70 @@
+#include <pigpio.h>
+
+#include "gpio.h"
+
+/* pins set to outputs here, so bank writes only switch the others */
+static uint32_t outputs;
+
+static int32_t pigpio_init(const char *arg)
+{
+    outputs = 0;
+    return gpioInitialise() == PI_INIT_FAILED ? -1 : 0;
+}
+
+static void pigpio_exit(void)
+{
+    gpioTerminate();
+}
+
+static int32_t pigpio_output(uint32_t pin)
+{
+    if (gpioSetMode(pin, PI_OUTPUT)) { return -1; }
+    outputs |= 1u << pin;
+    return 0;
+}
+
+static int32_t pigpio_input(uint32_t pin)
+{
+    outputs &= ~(1u << pin);
+    return gpioSetMode(pin, PI_INPUT) ? -1 : 0;
+}
+
+/* gpioWrite() switches the pin to an output itself */
+static int32_t pigpio_write(uint32_t pin, uint32_t level)
+{
+    if (gpioWrite(pin, level ? PI_HIGH : PI_LOW)) { return -1; }
+    outputs |= 1u << pin;
+    return 0;
+}
+
+/*
+ * A store to the set register and one to the clear register: the highs
+ * and the lows each change together, the two a bus write apart.
+ */
+static int32_t pigpio_write_mask(uint32_t mask, uint32_t values)
+{
+    for (uint32_t pin = 0; pin <= GPIO_MAX_PIN; pin++) {
+        if (mask & ~outputs & (1u << pin) && pigpio_output(pin) < 0) { return -1; }
+    }
+
+    if (mask & values && gpioWrite_Bits_0_31_Set(mask & values)) { return -1; }
+    if (mask & ~values && gpioWrite_Bits_0_31_Clear(mask & ~values)) { return -1; }
+    return 0;
+}
+
+static int32_t pigpio_read(uint32_t pin)
+{
+    int32_t level = gpioRead(pin);
+    return level < 0 ? -1 : level;
+}
+
+const struct gpio_backend gpio_pigpio_backend = {
+    .name = "pigpio",
+    .init = pigpio_init,
+    .exit = pigpio_exit,
+    .output = pigpio_output,
+    .input = pigpio_input,
+    .write = pigpio_write,
+    .write_mask = pigpio_write_mask,
+    .read = pigpio_read,
+};
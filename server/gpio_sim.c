@@ -0,0 +1,75 @@
+/*
+ * Pins in memory, for running and benchmarking the server off a Pi.
+ * "sim:<us>" makes every write take that long, standing in for the time
+ * real hardware needs to actuate.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gpio.h"
+
+static uint32_t levels;
+static uint32_t outputs;
+static uint32_t latency_us;
+
+static int32_t sim_init(const char *arg)
+{
+    levels = outputs = 0;
+    latency_us = arg ? strtoul(arg, NULL, 10) : 0;
+    printf("Simulated GPIO, %u us per write\n", latency_us);
+    return 0;
+}
+
+static void sim_exit(void)
+{
+}
+
+static int32_t sim_output(uint32_t pin)
+{
+    outputs |= 1u << pin;
+    return 0;
+}
+
+static int32_t sim_input(uint32_t pin)
+{
+    outputs &= ~(1u << pin);
+    return 0;
+}
+
+/* one latency for the whole mask, as for a bank write on hardware */
+static int32_t sim_write_mask(uint32_t mask, uint32_t values)
+{
+    if (latency_us) {
+        struct timespec ts = {
+            .tv_sec = latency_us / 1000000,
+            .tv_nsec = (latency_us % 1000000) * 1000L,
+        };
+        nanosleep(&ts, NULL);
+    }
+
+    outputs |= mask;
+    levels = (levels & ~mask) | (values & mask);
+    return 0;
+}
+
+static int32_t sim_write(uint32_t pin, uint32_t level)
+{
+    return sim_write_mask(1u << pin, level ? 1u << pin : 0);
+}
+
+static int32_t sim_read(uint32_t pin)
+{
+    return (levels >> pin) & 1;
+}
+
+const struct gpio_backend gpio_sim_backend = {
+    .name = "sim",
+    .init = sim_init,
+    .exit = sim_exit,
+    .output = sim_output,
+    .input = sim_input,
+    .write = sim_write,
+    .write_mask = sim_write_mask,
+    .read = sim_read,
+};
@@ -1,6 +1,10 @@
 #include<stdio.h>
 #include<signal.h>
-#include<pigpio.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<time.h>
+
+#include "gpio.h"
 
 const uint32_t red_led = 21;
 volatile sig_atomic_t signal_received = 0;
@@ -10,25 +14,37 @@ void siginit_handler (int signal)
 	signal_received = signal;
 }
 
+/* sleeps until a second after the last wake-up was due, so the blink keeps time */
+void tick (struct timespec *next)
+{
+	next->tv_sec++;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) && !signal_received)
+		;
+}
+
 int main (int argc, char** argv)
 {
-	if (gpioInitialise() == PI_INIT_FAILED) {
+	struct timespec next;
+
+	/* led [backend[:arg]], the default backend otherwise */
+	if (gpio_init(argc > 1 ? argv[1] : NULL) < 0) {
 		printf("ERROR: Failed to initialize the GPIO interface\n");
 		return 1;
 	}
 	
-	gpioSetMode(red_led, PI_OUTPUT);
+	gpio_output(red_led);
 	signal(SIGINT, siginit_handler);
 	printf("Press CTRL-C to exit\n");
+	clock_gettime(CLOCK_MONOTONIC, &next);
 	while (!signal_received) {
-		gpioWrite(red_led, PI_HIGH);
-		time_sleep(1);
-		gpioWrite(red_led, PI_LOW);
-		time_sleep(1);
+		gpio_write(red_led, 1);
+		tick(&next);
+		gpio_write(red_led, 0);
+		tick(&next);
 	}
 
-	gpioSetMode(red_led, PI_INPUT);
-	gpioTerminate();
+	gpio_input(red_led);
+	gpio_exit();
 	printf("\n");
 	return 0;
 }
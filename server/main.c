@@ -1,45 +1,793 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
 #include <termios.h>
+#include <getopt.h>
 #include <signal.h>
-#include <pigpio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "framer.h"
+#include "gpio.h"
+#include "cmd_hash.h"
+#include "proto.h"
+#include "sched.h"
+#include "serial.h"
+
+/* input this soon after start is whatever the gadget link buffered, drop it */
+#define SETTLE_MS 1000
+/* a hung up link reports EPOLLHUP until the host reopens it, so back off */
+#define HANGUP_RETRY_MS 500
+#define MAX_EVENTS 8
+/* timed actions in flight, all on the one scheduler timer */
+#define MAX_JOBS SCHED_MAX
+#define MAX_PULSE_NS (60 * 1000000000ull)
+/* a faster blink would keep the loop toggling pins and little else */
+#define MIN_BLINK_NS 100000ull
+#define MAX_DELAY_NS (24 * 3600 * 1000000000ull)
+/* the command line "At" keeps for later */
+#define AT_COMMAND_SIZE 64
 
 const uint32_t red_led = 21;
 volatile sig_atomic_t signal_received = 0;
 
 
 int32_t SERIAL_ID = -1;
+int32_t EPOLL_ID = -1;
+
+/* replies the tty could not take yet, flushed on EPOLLOUT */
+struct output {
+    char buf[4096];
+    size_t len;
+};
+
+static struct output serial_out;
+/* commands may arrive split over reads or several to a read */
+static struct framer serial_in;
+static int32_t settling = 1;
+static int32_t hung_up;        /* off epoll until the retry timer */
+static int32_t link_down;      /* reported once, until the host talks again */
+
+/* set by "Proto", until then and after a hangup the link speaks text */
+static int32_t binary;
+static uint16_t request_id;     /* of the binary command being handled */
+/* bumped on every hangup, completions for an earlier host are dropped */
+static uint32_t session;
+/* the session the command being handled answers to, replies go nowhere else */
+static uint32_t request_session;
+/* commands run by "At" answer to no session */
+#define SESSION_NONE UINT32_MAX
+
+/*
+ * A command whose work finishes after it returned. The handler starts
+ * the job and replies nothing, or only the job's handle; step() runs
+ * from the event loop when the job's deadline comes and sends the reply
+ * if any, tagged with the id the request came with, while other commands
+ * keep being served in the meantime. "Cancel <handle>" ends a job early.
+ */
+struct job;
+typedef void (*job_fn)(struct job *job);
+
+struct job {
+    struct sched_timer timer;   /* first, job_fire() gets the job from it */
+    job_fn step;                /* NULL while the slot is free */
+    uint32_t handle;            /* the slot plus MAX_JOBS times its reuses */
+    uint16_t id;
+    uint32_t session;
+    uint32_t pin;
+    uint32_t level;
+    uint64_t period;            /* ns between a blink's edges */
+    uint32_t count;             /* blinks left, 0 for until cancelled */
+    char command[AT_COMMAND_SIZE];
+};
+
+static struct job jobs[MAX_JOBS];
+static uint32_t next_job;       /* where the search for a free slot starts */
+/* the pulse or blink driving each pin, one at a time or they fight over it */
+static struct job *pin_jobs[GPIO_MAX_PIN + 1];
 
-void sigint_handler(int signal)
+/* one-shot timerfd firing after ms, 0 disarms it */
+int32_t timer_arm(int32_t timer, uint32_t ms)
 {
-    signal_received = signal;
-    gpioSetMode(red_led, PI_INPUT);
-    gpioTerminate();
-    close(SERIAL_ID);
+    struct itimerspec spec = {
+        .it_value = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L },
+    };
+
+    return timerfd_settime(timer, 0, &spec, NULL);
+}
+
+int32_t timer_start(uint32_t ms)
+{
+    int32_t timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer < 0) { return -1; }
+
+    if (timer_arm(timer, ms) < 0) {
+        close(timer);
+        return -1;
+    }
+    return timer;
+}
+
+/* acknowledges the expiry so the fd stops polling readable */
+void timer_ack(int32_t timer)
+{
+    uint64_t expirations;
+    if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        perror("Failed to read timer");
+    }
+}
+
+int32_t epoll_watch(int32_t op, int32_t fd, uint32_t events)
+{
+    struct epoll_event event = { .events = events, .data.fd = fd };
+    return epoll_ctl(EPOLL_ID, op, fd, &event);
+}
+
+void serial_flush(void)
+{
+    while (serial_out.len) {
+        ssize_t written = write(SERIAL_ID, serial_out.buf, serial_out.len);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno != EAGAIN) {
+                perror("Failed to write reply");
+                serial_out.len = 0;
+            }
+            break;
+        }
+        memmove(serial_out.buf, serial_out.buf + written, serial_out.len - written);
+        serial_out.len -= written;
+    }
+
+    /* only ask for EPOLLOUT while something is left over */
+    if (hung_up) { return; }
+    epoll_watch(EPOLL_CTL_MOD, SERIAL_ID, EPOLLIN | (serial_out.len ? EPOLLOUT : 0));
+}
+
+void serial_send(const void *data, size_t len)
+{
+    if (serial_out.len + len > sizeof(serial_out.buf)) {
+        printf("Reply buffer full, dropping %zu bytes\n", len);
+        return;
+    }
+    memcpy(serial_out.buf + serial_out.len, data, len);
+    serial_out.len += len;
+    serial_flush();
+}
+
+/* a text line, or its frame tagged with the request id once binary */
+void serial_reply_to(uint16_t id, const char *reply)
+{
+    uint8_t frame[PROTO_MAX_FRAME];
+    int32_t size;
+
+    if (!binary) {
+        serial_send(reply, strlen(reply));
+        return;
+    }
+
+    size = proto_encode(frame, sizeof(frame), PROTO_REPLY, id,
+                        reply, strcspn(reply, "\n"));
+    if (size > 0) { serial_send(frame, size); }
+}
+
+void serial_reply(const char *reply)
+{
+    if (request_session == session) { serial_reply_to(request_id, reply); }
+}
+
+void job_fire(struct sched_timer *timer)
+{
+    struct job *job = (struct job *)timer;
+    job->step(job);
+}
+
+/* takes over the request being handled, step() runs at deadline */
+struct job *job_start(uint64_t deadline, job_fn step)
+{
+    struct job *job = NULL;
+    uint32_t uses;
+
+    for (uint32_t i = 0; i < MAX_JOBS && !job; i++) {
+        uint32_t slot = (next_job + i) % MAX_JOBS;
+        if (!jobs[slot].step) { job = &jobs[slot]; }
+    }
+    if (!job) { return NULL; }
+
+    sched_timer_init(&job->timer, job_fire);
+    if (sched_add(&job->timer, deadline) < 0) { return NULL; }
+
+    next_job = (job - jobs + 1) % MAX_JOBS;
+    uses = job->handle / MAX_JOBS + 1;
+    if (uses > UINT32_MAX / MAX_JOBS) { uses = 1; }
+    job->handle = uses * MAX_JOBS + (job - jobs);
+    job->id = request_id;
+    job->session = request_session;
+    job->step = step;
+    return job;
+}
+
+/* frees the slot, the reply if any goes to the job's request */
+void job_done(struct job *job, const char *reply)
+{
+    if (reply && job->session == session) { serial_reply_to(job->id, reply); }
+
+    sched_cancel(&job->timer);
+    if (job->pin <= GPIO_MAX_PIN && pin_jobs[job->pin] == job) { pin_jobs[job->pin] = NULL; }
+    job->step = NULL;
+}
+
+/* the handle names its slot, the rest of it tells reuses of the slot apart */
+struct job *job_find(uint32_t handle)
+{
+    struct job *job = &jobs[handle % MAX_JOBS];
+
+    return job->step && job->handle == handle ? job : NULL;
+}
+
+void pulse_end(struct job *job);
+void blink_step(struct job *job);
+
+/* the first job driving one of the pins in mask */
+struct job *job_on_pins(uint32_t mask)
+{
+    for (uint32_t pin = 0; pin <= GPIO_MAX_PIN; pin++) {
+        if (mask & (1u << pin) && pin_jobs[pin]) { return pin_jobs[pin]; }
+    }
+    return NULL;
+}
+
+/* makes job the one driving pin until it is done */
+void job_own_pin(struct job *job, uint32_t pin)
+{
+    job->pin = pin;
+    pin_jobs[pin] = job;
+}
+
+/* a pin a job drove is left low, a pulse still owes its reply */
+void job_cancel(struct job *job)
+{
+    if (job->step == pulse_end || job->step == blink_step) { gpio_write(job->pin, 0); }
+    job_done(job, job->step == pulse_end ? "Cancelled\n" : NULL);
 }
 
-int32_t terminal_init(int32_t serial)
+/* outputs must not stay driven by jobs nobody will finish */
+void jobs_finish(void)
 {
-    if (serial< 0) { return -1; }
-    struct termios options;
+    for (int32_t i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].step) { job_cancel(&jobs[i]); }
+    }
+}
+
+/*
+ * "<n>" in ms, or with a unit: "<n>us", "<n>ms" or "<n>s". Returns the
+ * time in ns and the end of it, which is text on a bad or missing number.
+ */
+uint64_t parse_time(const char *text, char **end)
+{
+    static const struct { const char *unit; uint64_t ns; } units[] = {
+        { "us", 1000 }, { "ms", 1000000 }, { "s", 1000000000 },
+    };
+    unsigned long long value = strtoull(text, end, 10);
+    uint64_t scale = 1000000;
 
-    if(tcgetattr(serial, &options) < 0) { return -1; }
+    if (*end == text || *text == '-') {
+        *end = (char *)text;
+        return 0;
+    }
+    for (uint32_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        size_t len = strlen(units[i].unit);
+        if (!strncmp(*end, units[i].unit, len)) {
+            scale = units[i].ns;
+            *end += len;
+            break;
+        }
+    }
 
-    cfsetispeed(&options, B9600);
-    cfsetospeed(&options, B9600);
+    /* past every limit the callers check, but it must not wrap under them */
+    if (value > UINT64_MAX / scale) { return UINT64_MAX; }
+    return value * scale;
+}
 
-    options.c_iflag &= ~BRKINT;
-    options.c_iflag &= ~IMAXBEL;
-    options.c_lflag &= ~ECHO;
+/*
+ * A number that fits 32 bits, after any spaces, in base (0 also takes 0x
+ * hex). A sign, no number or one past UINT32_MAX fails with end at text:
+ * strtoul() saturates where long is 32 bits, so the range check has to
+ * be on a wider type.
+ */
+int32_t parse_u32(const char *text, char **end, int32_t base, uint32_t *value)
+{
+    const char *digits = text + strspn(text, " ");
+    unsigned long long parsed;
 
-    if (tcsetattr(serial, TCSANOW, &options) < 0) { return -1; }
+    errno = 0;
+    parsed = strtoull(digits, end, base);
+    if (*end == digits || *digits == '-' || *digits == '+' || errno == ERANGE
+        || parsed > UINT32_MAX) {
+        *end = (char *)text;
+        return -1;
+    }
+    *value = parsed;
     return 0;
 }
 
+void cmd_turn_on(const char *args)
+{
+    gpio_write(red_led, 1);
+    serial_reply("Done\n");
+    printf("Turn on -> Done\n");
+}
+
+void cmd_turn_off(const char *args)
+{
+    gpio_write(red_led, 0);
+    serial_reply("Done\n");
+    printf("Turn off -> Done\n");
+}
+
+void cmd_status(const char *args)
+{
+    char reply[32];
+
+    snprintf(reply, sizeof(reply), "Status %u %d\n", red_led, gpio_read(red_led));
+    serial_reply(reply);
+}
+
+void cmd_set(const char *args)
+{
+    char *pin_end, *end;
+    unsigned long pin = strtoul(args, &pin_end, 10);
+    unsigned long val = strtoul(pin_end, &end, 10);
+
+    if (pin_end == args || end == pin_end || *end || pin > GPIO_MAX_PIN || val > 1) {
+        printf("Bad arguments for Set: %s\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+
+    /* the job would undo it on its next edge */
+    if (job_on_pins(1u << pin)) {
+        printf("Pin %lu is pulsing or blinking\n", pin);
+        serial_reply("Error\n");
+        return;
+    }
+
+    if (gpio_output(pin) < 0 || gpio_write(pin, val) < 0) {
+        serial_reply("Error\n");
+        return;
+    }
+    serial_reply("Done\n");
+}
+
+/*
+ * "Write <mask> <values>" sets every pin in mask to its bit in values at
+ * once, both in decimal or 0x hex: "Write 0xff 0x0f" drives pins 0-3 high
+ * and 4-7 low.
+ */
+void cmd_write(const char *args)
+{
+    char *mask_end, *end;
+    uint32_t mask, values;
+    struct job *job;
+
+    if (parse_u32(args, &mask_end, 0, &mask) < 0
+        || parse_u32(mask_end, &end, 0, &values) < 0 || *end || !mask
+        || values & ~mask) {
+        printf("Bad arguments for Write: %s\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+
+    job = job_on_pins(mask);
+    if (job) {
+        printf("Pin %u is pulsing or blinking\n", job->pin);
+        serial_reply("Error\n");
+        return;
+    }
+
+    if (gpio_write_mask(mask, values) < 0) {
+        serial_reply("Error\n");
+        return;
+    }
+    serial_reply("Done\n");
+}
+
+void pulse_end(struct job *job)
+{
+    job_done(job, gpio_write(job->pin, 0) < 0 ? "Error\n" : "Done\n");
+}
+
+/* "Pulse <pin> <time>" holds the pin high and replies once it is low again */
+void cmd_pulse(const char *args)
+{
+    char *pin_end, *end;
+    unsigned long pin = strtoul(args, &pin_end, 10);
+    uint64_t ns = parse_time(pin_end + strspn(pin_end, " "), &end);
+    struct job *job;
+
+    if (pin_end == args || !ns || *end || pin > GPIO_MAX_PIN || ns > MAX_PULSE_NS) {
+        printf("Bad arguments for Pulse: %s\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+
+    /* a second pulse would end the first one early */
+    if (job_on_pins(1u << pin)) {
+        printf("Pin %lu is already pulsing or blinking\n", pin);
+        serial_reply("Error\n");
+        return;
+    }
+
+    if (gpio_output(pin) < 0 || gpio_write(pin, 1) < 0) {
+        serial_reply("Error\n");
+        return;
+    }
+
+    /* timed from the edge, the write may have taken a while */
+    job = job_start(sched_now() + ns, pulse_end);
+    if (!job) {
+        printf("No free job for Pulse\n");
+        gpio_write(pin, 0);
+        serial_reply("Error\n");
+        return;
+    }
+    job_own_pin(job, pin);
+}
+
+void blink_step(struct job *job)
+{
+    job->level = !job->level;
+    if (gpio_write(job->pin, job->level) < 0) {
+        job_cancel(job);
+        return;
+    }
+    if (!job->level && job->count && !--job->count) {
+        job_done(job, NULL);
+        return;
+    }
+    /* from the last deadline rather than now, so late edges do not add up */
+    if (sched_add(&job->timer, job->timer.deadline + job->period) < 0) { job_cancel(job); }
+}
+
+/*
+ * "Blink <pin> <period> [count]" toggles the pin every half period from
+ * high now, for count periods or until cancelled. Replies "Job <handle>"
+ * straight away, nothing when the blinking ends.
+ */
+void cmd_blink(const char *args)
+{
+    char reply[32];
+    char *pin_end, *period_end, *end;
+    unsigned long pin = strtoul(args, &pin_end, 10);
+    uint64_t period = parse_time(pin_end + strspn(pin_end, " "), &period_end);
+    uint32_t count = 0;
+    struct job *job;
+
+    /* the count is optional, a bad one leaves end on it */
+    end = period_end;
+    if (*end) { parse_u32(period_end, &end, 10, &count); }
+
+    if (pin_end == args || !period || *end || pin > GPIO_MAX_PIN
+        || period < MIN_BLINK_NS || period > MAX_DELAY_NS) {
+        printf("Bad arguments for Blink: %s\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+
+    if (job_on_pins(1u << pin)) {
+        printf("Pin %lu is already pulsing or blinking\n", pin);
+        serial_reply("Error\n");
+        return;
+    }
+
+    if (gpio_output(pin) < 0 || gpio_write(pin, 1) < 0) {
+        serial_reply("Error\n");
+        return;
+    }
+
+    job = job_start(sched_now() + period / 2, blink_step);
+    if (!job) {
+        printf("No free job for Blink\n");
+        gpio_write(pin, 0);
+        serial_reply("Error\n");
+        return;
+    }
+    job_own_pin(job, pin);
+    job->level = 1;
+    job->period = period / 2;
+    job->count = count;
+
+    snprintf(reply, sizeof(reply), "Job %u\n", job->handle);
+    serial_reply(reply);
+}
+
+void handle_command(char *line);
+
+/* what the command replies goes nowhere, nobody is waiting for it */
+void at_run(struct job *job)
+{
+    char command[AT_COMMAND_SIZE];
+    uint16_t id = request_id;
+    uint32_t reply_session = request_session;
+
+    /* the slot is free again before the command might want one */
+    strcpy(command, job->command);
+    job_done(job, NULL);
+
+    request_id = 0;
+    request_session = SESSION_NONE;
+    handle_command(command);
+    request_id = id;
+    request_session = reply_session;
+}
+
+/*
+ * "At <time> <command>" runs the command line after time, or at it when
+ * written "@<time>", read against the server's clock from "Clock".
+ * Replies "Job <handle>" straight away.
+ */
+void cmd_at(const char *args)
+{
+    char reply[32];
+    char *end;
+    int32_t absolute = *args == '@';
+    uint64_t ns = parse_time(args + absolute, &end);
+    const char *command = end + strspn(end, " ");
+    uint64_t now = sched_now();
+    struct job *job;
+
+    if (end == args + absolute || command == end || !*command
+        || strlen(command) >= AT_COMMAND_SIZE
+        || (absolute ? ns > now + MAX_DELAY_NS : ns > MAX_DELAY_NS)) {
+        printf("Bad arguments for At: %s\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+
+    job = job_start(absolute ? ns : now + ns, at_run);
+    if (!job) {
+        printf("No free job for At\n");
+        serial_reply("Error\n");
+        return;
+    }
+    strcpy(job->command, command);
+
+    snprintf(reply, sizeof(reply), "Job %u\n", job->handle);
+    serial_reply(reply);
+}
+
+/* "Cancel <handle>" ends a job early, pins it drove are left low */
+void cmd_cancel(const char *args)
+{
+    char *end;
+    unsigned long handle = strtoul(args, &end, 10);
+    struct job *job = end == args || *end ? NULL : job_find(handle);
+
+    if (!job) {
+        printf("No job %s to cancel\n", args);
+        serial_reply("Error\n");
+        return;
+    }
+    job_cancel(job);
+    serial_reply("Done\n");
+}
+
+/* "Clock" replies the server's monotonic time in us, for "At @<time>us" */
+void cmd_clock(const char *args)
+{
+    char reply[48];
+
+    snprintf(reply, sizeof(reply), "Clock %llu\n",
+             (unsigned long long)(sched_now() / 1000));
+    serial_reply(reply);
+}
+
+/* "Proto <version>" switches the link to binary frames after the reply */
+void cmd_proto(const char *args)
+{
+    char reply[32];
+    char *end;
+    unsigned long version = strtoul(args, &end, 10);
+
+    if (end == args || *end || version < 1) {
+        serial_reply("Error\n");
+        return;
+    }
+    /* from "At" the host never sees the reply, the link would just go quiet */
+    if (request_session == SESSION_NONE) {
+        printf("Proto needs a host to answer\n");
+        serial_reply("Error\n");
+        return;
+    }
+    if (version > PROTO_VERSION) { version = PROTO_VERSION; }
+    snprintf(reply, sizeof(reply), "Proto %lu %d\n", version, PROTO_MAX_PAYLOAD);
+
+    /* the port is raw already, frames pass the line discipline untouched */
+    serial_reply(reply);
+    binary = 1;
+    printf("Switched to binary protocol version %lu\n", version);
+}
+
+typedef void (*command_fn)(const char *args);
+
+static const command_fn command_handlers[CMD_NR] = {
+#define COMMAND(ID, name, verb, usage, label) [CMD_##ID] = cmd_##name,
+#include "commands.def"
+#undef COMMAND
+};
+
+/* one hash and one compare, the table comes from gen_cmdhash */
+int32_t command_find(const char *verb, size_t len)
+{
+    uint32_t slot = command_hash(verb, len, COMMAND_HASH_SEED) & (COMMAND_HASH_SIZE - 1);
+    int32_t id = command_slots[slot];
+
+    if (id < 0 || strncmp(commands[id].verb, verb, len) || commands[id].verb[len]) {
+        return -1;
+    }
+    return id;
+}
+
+void run_command(int32_t id, const char *args)
+{
+    if (!commands[id].usage[0] && *args) {
+        printf("%s takes no arguments\n", commands[id].verb);
+        serial_reply("Error\n");
+        return;
+    }
+    command_handlers[id](args);
+}
+
+/* the whole line is a verb ("Turn on"), or the first word is and arguments follow */
+void handle_command(char *line)
+{
+    size_t len = strcspn(line, "\r\n");
+    const char *args;
+    int32_t id;
+
+    line[len] = '\0';
+    printf("Command: %s\n", line);
+
+    id = command_find(line, len);
+    args = line + len;
+    if (id < 0) {
+        size_t verb_len = strcspn(line, " ");
+
+        id = command_find(line, verb_len);
+        args = line + verb_len + strspn(line + verb_len, " ");
+    }
+
+    if (id < 0) {
+        printf("Unhandled message: %s\n", line);
+        serial_reply("Error\n");
+        return;
+    }
+    run_command(id, args);
+}
+
+/* a command frame carries the commands.def id and then the argument text */
+void handle_frame(const struct proto_msg *msg)
+{
+    char args[PROTO_MAX_PAYLOAD];
+
+    request_id = msg->id;
+    request_session = session;
+    if (msg->type != PROTO_COMMAND || msg->len < 1 || msg->payload[0] >= CMD_NR) {
+        printf("Unhandled frame %u of type %u\n", msg->id, msg->type);
+        serial_reply("Error\n");
+        return;
+    }
+
+    memcpy(args, msg->payload + 1, msg->len - 1);
+    args[msg->len - 1] = '\0';
+    printf("Command %u: %s %s\n", msg->id, commands[msg->payload[0]].verb, args);
+
+    run_command(msg->payload[0], args);
+}
+
+/* takes the next good frame out of the input, 0 while none is complete */
+int32_t serial_next_frame(uint8_t *frame, struct proto_msg *msg)
+{
+    for (;;) {
+        size_t have = framer_peek(&serial_in, frame, PROTO_MAX_FRAME);
+        int32_t size = proto_frame_size(frame, have);
+
+        if (size < 0) {
+            /* not at a frame start, hunt for the next magic */
+            framer_skip(&serial_in, 1);
+            continue;
+        }
+        if (size == 0 || (size_t)size > have) { return 0; }
+
+        /* a corrupted length is only caught by the CRC, resync from the next byte */
+        if (proto_decode(frame, size, msg) < 0) {
+            printf("Dropped a frame with a bad CRC\n");
+            framer_skip(&serial_in, 1);
+            continue;
+        }
+
+        framer_skip(&serial_in, size);
+        return 1;
+    }
+}
+
+/* runs every command completed by this chunk of input */
+void serial_frame(const char *data, size_t len)
+{
+    char line[FRAMER_SIZE + 1];
+    uint8_t frame[PROTO_MAX_FRAME];
+    struct proto_msg msg;
+    uint32_t dropped = serial_in.dropped;
+
+    while (len) {
+        size_t taken = framer_push(&serial_in, data, len);
+        data += taken;
+        len -= taken;
+
+        /* a "Proto" line switches over for whatever follows it */
+        for (;;) {
+            if (binary) {
+                if (!serial_next_frame(frame, &msg)) { break; }
+                handle_frame(&msg);
+                continue;
+            }
+
+            size_t line_size = framer_next(&serial_in, line, sizeof(line));
+            if (!line_size) { break; }
+            if (line_size < 2) { continue; }
+            request_id = 0;
+            request_session = session;
+            handle_command(line);
+        }
+    }
+
+    if (serial_in.dropped != dropped) {
+        printf("Dropped a command longer than %d bytes\n", FRAMER_SIZE);
+    }
+}
+
+void serial_read(int32_t hangup_timer)
+{
+    char buffer[100];
+    ssize_t read_size;
+
+    for (;;) {
+        read_size = read(SERIAL_ID, buffer, sizeof(buffer));
+        if (read_size < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN) { return; }
+            if (errno != EIO) {
+                perror("Failed to read serial port");
+                return;
+            }
+        }
+
+        /* EPOLLHUP is reported whatever the mask, so stop watching until the retry */
+        if (read_size <= 0) {
+            if (!link_down) { printf("Serial link hung up, waiting for the host\n"); }
+            link_down = 1;
+            /* back to text for the next host, it has to negotiate again */
+            binary = 0;
+            framer_init(&serial_in);
+            session++;
+            hung_up = 1;
+            epoll_watch(EPOLL_CTL_DEL, SERIAL_ID, 0);
+            timer_arm(hangup_timer, HANGUP_RETRY_MS);
+            return;
+        }
+
+        link_down = 0;
+        if (settling) { continue; }
+
+        serial_frame(buffer, read_size);
+    }
+}
+
 void print_entry()
 {
     printf("################################################\n");
@@ -54,63 +802,144 @@ void print_entry()
 
 }
 
-int32_t main() {
-    if(gpioInitialise() == PI_INIT_FAILED) {
-        perror("Failed to initialize the GPIO interface\n");
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d device] [-b baud] [-g backend[:arg]]\n", prog);
+    fprintf(stderr, "GPIO backends: %s\n", gpio_backends());
+}
+
+int32_t main(int32_t argc, char **argv) {
+    struct epoll_event events[MAX_EVENTS];
+    struct signalfd_siginfo siginfo;
+    int32_t signal_id, settle_timer, hangup_timer, sched_timer;
+    sigset_t mask;
+    /* non-blocking reads, so VMIN/VTIME do not matter here */
+    struct serial_config serial_config = SERIAL_CONFIG_DEFAULT;
+    const char *device = "/dev/ttyGS0";
+    const char *gpio_spec = NULL;
+    int32_t opt;
+
+    while ((opt = getopt(argc, argv, "d:b:g:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'g':
+            gpio_spec = optarg;
+            break;
+        case 'b':
+            serial_config.speed = serial_speed(strtoul(optarg, NULL, 10));
+            if (!serial_config.speed) {
+                fprintf(stderr, "Unsupported baud rate %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    /* blocked before a backend starts threads (pigpio does), so they inherit the mask */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("Failed to block signals");
+        return -1;
+    }
+
+    if(gpio_init(gpio_spec) < 0) {
+        fprintf(stderr, "Failed to initialize the GPIO interface\n");
 	return -1;
     }
 
-    SERIAL_ID = open("/dev/ttyGS0", O_RDWR);
+    SERIAL_ID = serial_open(device, O_RDWR | O_NONBLOCK, &serial_config);
     if (SERIAL_ID < 0) {
         perror("Error opening serial port");
         return -1;
     }
 
-    if(terminal_init(SERIAL_ID)) {
-        perror("Failed to setup terminal connection!\n");
-	return -1;
+    signal_id = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    settle_timer = timer_start(SETTLE_MS);
+    hangup_timer = timer_start(0);
+    sched_timer = sched_init();
+    EPOLL_ID = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_id < 0 || settle_timer < 0 || hangup_timer < 0 || sched_timer < 0
+        || EPOLL_ID < 0) {
+        perror("Failed to set up the event loop");
+        return -1;
+    }
+
+    if (epoll_watch(EPOLL_CTL_ADD, SERIAL_ID, EPOLLIN)
+        || epoll_watch(EPOLL_CTL_ADD, signal_id, EPOLLIN)
+        || epoll_watch(EPOLL_CTL_ADD, settle_timer, EPOLLIN)
+        || epoll_watch(EPOLL_CTL_ADD, hangup_timer, EPOLLIN)
+        || epoll_watch(EPOLL_CTL_ADD, sched_timer, EPOLLIN)) {
+        perror("Failed to watch the event sources");
+        return -1;
     }
 
     print_entry();
 
     tcflush(SERIAL_ID, TCIOFLUSH);
-    sleep(1);
-    char buffer[100];
-    int32_t read_size = 0;
-    gpioSetMode(red_led, PI_OUTPUT);
-    signal(SIGINT, sigint_handler);
+    framer_init(&serial_in);
+    gpio_output(red_led);
 
     while (!signal_received) {
-        read_size = read(SERIAL_ID, buffer, sizeof(buffer) - 1);  // Read response
-        if (read_size > 1) {
-            buffer[read_size] = '\0';
-            printf("Command: %s\n", buffer);
-            if (!strcmp(buffer, "Turn on\n")) {
-                gpioWrite(red_led, PI_HIGH);
-                time_sleep(1);
-                tcflush(SERIAL_ID, TCIOFLUSH);
-                write(SERIAL_ID, "Done\n", 5);
-                printf("Turn on -> Done\n");
-                tcdrain(SERIAL_ID);
-                sleep(1);
+        int32_t ready = epoll_wait(EPOLL_ID, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) { continue; }
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int32_t i = 0; i < ready; i++) {
+            int32_t fd = events[i].data.fd;
+
+            if (fd == signal_id) {
+                if (read(signal_id, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) {
+                    signal_received = siginfo.ssi_signo;
+                }
+            }
+            else if (fd == settle_timer) {
+                timer_ack(settle_timer);
+                tcflush(SERIAL_ID, TCIFLUSH);
+                framer_init(&serial_in);
+                settling = 0;
             }
-            else if (!strcmp(buffer, "Turn off\n")) {
-                gpioWrite(red_led, PI_LOW);
-                time_sleep(1);
-                tcflush(SERIAL_ID, TCIOFLUSH);
-                write(SERIAL_ID, "Done\n", 5);
-                printf("Turn off -> Done\n");
-                tcdrain(SERIAL_ID);
-                sleep(1);
+            else if (fd == hangup_timer) {
+                timer_ack(hangup_timer);
+                hung_up = 0;
+                epoll_watch(EPOLL_CTL_ADD, SERIAL_ID,
+                            EPOLLIN | (serial_out.len ? EPOLLOUT : 0));
             }
-            else {
-                printf("Unhandled message: %s\n", buffer);
+            else if (fd == SERIAL_ID) {
+                if (events[i].events & EPOLLOUT) { serial_flush(); }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    serial_read(hangup_timer);
+                }
+            }
+            else if (fd == sched_timer) {
+                sched_run();
             }
         }
-        sleep(1);  // Wait for next data
     }
 
-    gpioTerminate();
+    jobs_finish();
+    if (sched_stats()->runs) {
+        const struct sched_stats *stats = sched_stats();
+        printf("Ran %llu timed actions, %.1f us late on average, %.1f us at worst\n",
+               (unsigned long long)stats->runs,
+               stats->total_late_ns / 1e3 / stats->runs, stats->max_late_ns / 1e3);
+    }
+    sched_exit();
+    gpio_input(red_led);
+    gpio_exit();
+    close(EPOLL_ID);
+    close(hangup_timer);
+    close(settle_timer);
+    close(signal_id);
     close(SERIAL_ID);
     return 0;
 }
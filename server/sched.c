@@ -0,0 +1,167 @@
+/*
+ * Timed actions on one timerfd. The waiting timers are a binary min-heap
+ * on their deadlines and the timerfd is armed with TFD_TIMER_ABSTIME for
+ * the earliest, so adding or cancelling is O(log n) with no fd per timer.
+ *
+ * Deadlines are absolute: a timer that fires and re-adds itself at its
+ * old deadline plus a period stays in phase however late it ran, where
+ * a relative sleep adds every run's latency to the next one.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "sched.h"
+
+static struct sched_timer *heap[SCHED_MAX];
+static uint32_t nr_timers;
+static int32_t timer_fd = -1;
+/* sched_run() arms once for what is left, not on every add from a timer */
+static int32_t running;
+static struct sched_stats stats;
+
+uint64_t sched_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void heap_set(uint32_t i, struct sched_timer *timer)
+{
+    heap[i] = timer;
+    timer->index = i;
+}
+
+static void sift_up(uint32_t i)
+{
+    struct sched_timer *timer = heap[i];
+
+    while (i) {
+        uint32_t parent = (i - 1) / 2;
+        if (heap[parent]->deadline <= timer->deadline) { break; }
+        heap_set(i, heap[parent]);
+        i = parent;
+    }
+    heap_set(i, timer);
+}
+
+static void sift_down(uint32_t i)
+{
+    struct sched_timer *timer = heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= nr_timers) { break; }
+        if (child + 1 < nr_timers && heap[child + 1]->deadline < heap[child]->deadline) {
+            child++;
+        }
+        if (timer->deadline <= heap[child]->deadline) { break; }
+        heap_set(i, heap[child]);
+        i = child;
+    }
+    heap_set(i, timer);
+}
+
+static void heap_remove(struct sched_timer *timer)
+{
+    uint32_t i = timer->index;
+    struct sched_timer *last = heap[--nr_timers];
+
+    timer->index = -1;
+    if (i == nr_timers) { return; }
+
+    heap_set(i, last);
+    sift_up(i);
+    sift_down(last->index);
+}
+
+/* for the earliest deadline, or disarmed with none left */
+static void sched_arm(void)
+{
+    struct itimerspec spec = { 0 };
+
+    if (running) { return; }
+    if (nr_timers) {
+        spec.it_value.tv_sec = heap[0]->deadline / 1000000000;
+        spec.it_value.tv_nsec = heap[0]->deadline % 1000000000;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        perror("Failed to arm the scheduler");
+    }
+}
+
+int32_t sched_init(void)
+{
+    nr_timers = 0;
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return timer_fd;
+}
+
+void sched_exit(void)
+{
+    while (nr_timers) { heap_remove(heap[0]); }
+    close(timer_fd);
+    timer_fd = -1;
+}
+
+void sched_timer_init(struct sched_timer *timer, sched_fn fn)
+{
+    timer->deadline = 0;
+    timer->index = -1;
+    timer->fn = fn;
+}
+
+int32_t sched_add(struct sched_timer *timer, uint64_t deadline)
+{
+    if (timer->index >= 0) { heap_remove(timer); }
+    if (nr_timers == SCHED_MAX) { return -1; }
+
+    timer->deadline = deadline;
+    heap_set(nr_timers, timer);
+    sift_up(nr_timers++);
+    if (!timer->index) { sched_arm(); }
+    return 0;
+}
+
+void sched_cancel(struct sched_timer *timer)
+{
+    int32_t was_first = !timer->index;
+
+    if (timer->index < 0) { return; }
+    heap_remove(timer);
+    if (was_first) { sched_arm(); }
+}
+
+/* runs every timer that is due, including ones re-added while running */
+void sched_run(void)
+{
+    uint64_t expirations, now;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        perror("Failed to read the scheduler timer");
+    }
+
+    running = 1;
+    now = sched_now();
+    while (nr_timers && heap[0]->deadline <= now) {
+        struct sched_timer *timer = heap[0];
+        uint64_t late = sched_now() - timer->deadline;
+
+        heap_remove(timer);
+        stats.runs++;
+        stats.total_late_ns += late;
+        if (late > stats.max_late_ns) { stats.max_late_ns = late; }
+        timer->fn(timer);
+    }
+    running = 0;
+    sched_arm();
+}
+
+const struct sched_stats *sched_stats(void)
+{
+    return &stats;
+}
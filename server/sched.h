@@ -0,0 +1,40 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* timers that can be waiting at once */
+#define SCHED_MAX 4096
+
+struct sched_timer;
+typedef void (*sched_fn)(struct sched_timer *timer);
+
+/*
+ * Embedded in whatever the timer is for. deadline is absolute, in
+ * CLOCK_MONOTONIC nanoseconds; index is the heap slot, -1 while the
+ * timer is not waiting, which includes while fn runs.
+ */
+struct sched_timer {
+    uint64_t deadline;
+    int32_t index;
+    sched_fn fn;
+};
+
+struct sched_stats {
+    uint64_t runs;
+    uint64_t total_late_ns; /* deadline to fn being called */
+    uint64_t max_late_ns;
+};
+
+/* returns the timerfd to watch for EPOLLIN, sched_run() when it is */
+int32_t sched_init(void);
+void sched_exit(void);
+void sched_run(void);
+
+uint64_t sched_now(void);
+void sched_timer_init(struct sched_timer *timer, sched_fn fn);
+int32_t sched_add(struct sched_timer *timer, uint64_t deadline);
+void sched_cancel(struct sched_timer *timer);
+const struct sched_stats *sched_stats(void);
+
+#endif
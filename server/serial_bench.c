@@ -0,0 +1,243 @@
+/*
+ * Canonical vs raw termios on the command link.
+ *
+ *     serial_bench [-n round trips] [-m megabytes]
+ *         a pty pair, this process on both ends: the slave end is set up
+ *         the way the server used to do it (canonical, B9600, no echo) or
+ *         raw through serial_configure(), and echoes what it reads
+ *
+ *     serial_bench -d /dev/ttyACM0 [-n round trips]
+ *         against a running server, "Status" round trips with the host
+ *         end of the link in either mode
+ *
+ * Round trips are one command line and its reply; throughput is 64 byte
+ * lines written in bulk, with the number of read() calls it took.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <termios.h>
+#include <pthread.h>
+#include <pty.h>
+#include <time.h>
+
+#include "serial.h"
+
+#define LINE "Status\n"
+#define BULK_LINE 64
+
+enum mode { MODE_CANONICAL, MODE_RAW, MODE_NR };
+
+static const char *const mode_names[MODE_NR] = { "canonical", "raw" };
+
+/* the settings terminal_init() used to apply */
+static int32_t setup_canonical(int32_t fd)
+{
+    struct termios options;
+
+    if (tcgetattr(fd, &options) < 0) { return -1; }
+
+    cfsetispeed(&options, B9600);
+    cfsetospeed(&options, B9600);
+    options.c_iflag &= ~BRKINT;
+    options.c_iflag &= ~IMAXBEL;
+    options.c_lflag |= ICANON;
+    options.c_lflag &= ~ECHO;
+
+    return tcsetattr(fd, TCSANOW, &options);
+}
+
+static int32_t setup(int32_t fd, enum mode mode)
+{
+    const struct serial_config config = SERIAL_CONFIG_DEFAULT;
+
+    return mode == MODE_RAW ? serial_configure(fd, &config) : setup_canonical(fd);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int32_t write_all(int32_t fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/* reads until a '\n', returns the number of read() calls it took */
+static int32_t read_line(int32_t fd)
+{
+    char buf[256];
+    int32_t reads = 0;
+
+    for (;;) {
+        ssize_t read_size = read(fd, buf, sizeof(buf));
+        if (read_size < 0 && errno == EINTR) { continue; }
+        if (read_size <= 0) { return -1; }
+        reads++;
+        if (memchr(buf, '\n', read_size)) { return reads; }
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+struct echo {
+    int32_t fd;
+    size_t bulk;            /* bytes to swallow after the round trips */
+    uint64_t reads;
+    uint64_t done_ns;
+};
+
+/* the device end: answers every line, then counts the bulk transfer */
+static void *echo_thread(void *arg)
+{
+    struct echo *echo = arg;
+    char buf[4096];
+    size_t got = 0;
+
+    for (;;) {
+        ssize_t read_size = read(echo->fd, buf, sizeof(buf));
+        if (read_size <= 0) { return NULL; }
+        if (buf[0] == 'B') { got = read_size; break; }
+        write_all(echo->fd, buf, read_size);
+    }
+
+    echo->reads = 1;
+    while (got < echo->bulk) {
+        ssize_t read_size = read(echo->fd, buf, sizeof(buf));
+        if (read_size <= 0) { return NULL; }
+        got += read_size;
+        echo->reads++;
+    }
+    echo->done_ns = now_ns();
+    return NULL;
+}
+
+static void print_rtt(enum mode mode, uint64_t *rtt, int32_t n, double reads)
+{
+    qsort(rtt, n, sizeof(*rtt), cmp_u64);
+    printf("%-10s rtt p50 %7.1f us  p99 %7.1f us  reads/reply %.2f",
+           mode_names[mode], rtt[n / 2] / 1e3, rtt[n * 99 / 100] / 1e3, reads);
+}
+
+static int32_t bench_pty(enum mode mode, int32_t n, size_t bulk)
+{
+    struct echo echo = { .bulk = bulk };
+    uint64_t *rtt = calloc(n, sizeof(*rtt));
+    char *data = malloc(bulk);
+    int32_t host, reads = 0;
+    pthread_t thread;
+
+    if (!rtt || !data || openpty(&host, &echo.fd, NULL, NULL, NULL) < 0) {
+        perror("openpty");
+        return -1;
+    }
+
+    /* the host end stays raw, only the device end changes */
+    const struct serial_config config = SERIAL_CONFIG_DEFAULT;
+    if (serial_configure(host, &config) < 0 || setup(echo.fd, mode) < 0) {
+        perror("Failed to configure the pty");
+        return -1;
+    }
+    pthread_create(&thread, NULL, echo_thread, &echo);
+
+    for (int32_t i = 0; i < n; i++) {
+        uint64_t start = now_ns();
+        write_all(host, LINE, strlen(LINE));
+        reads += read_line(host);
+        rtt[i] = now_ns() - start;
+    }
+    print_rtt(mode, rtt, n, (double)reads / n);
+
+    for (size_t i = 0; i < bulk; i++) {
+        data[i] = i % BULK_LINE == BULK_LINE - 1 ? '\n' : 'B';
+    }
+    uint64_t start = now_ns();
+    write_all(host, data, bulk);
+    pthread_join(thread, NULL);
+
+    double secs = (echo.done_ns - start) / 1e9;
+    printf("  %7.1f MB/s  %6.1f bytes/read\n", bulk / secs / 1e6,
+           (double)bulk / echo.reads);
+
+    close(host);
+    close(echo.fd);
+    free(data);
+    free(rtt);
+    return 0;
+}
+
+static int32_t bench_device(const char *device, enum mode mode, int32_t n)
+{
+    uint64_t *rtt = calloc(n, sizeof(*rtt));
+    int32_t fd = open(device, O_RDWR | O_NOCTTY), reads = 0;
+
+    if (!rtt || fd < 0 || setup(fd, mode) < 0) {
+        perror(device);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    for (int32_t i = 0; i < n; i++) {
+        uint64_t start = now_ns();
+        write_all(fd, LINE, strlen(LINE));
+        int32_t line_reads = read_line(fd);
+        if (line_reads < 0) {
+            perror("No reply from the server");
+            return -1;
+        }
+        reads += line_reads;
+        rtt[i] = now_ns() - start;
+    }
+    print_rtt(mode, rtt, n, (double)reads / n);
+    printf("\n");
+
+    close(fd);
+    free(rtt);
+    return 0;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    const char *device = NULL;
+    int32_t n = 10000, opt;
+    size_t bulk = 16 << 20;
+
+    while ((opt = getopt(argc, argv, "d:n:m:")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'n': n = atoi(optarg); break;
+        case 'm': bulk = (size_t)atoi(optarg) << 20; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-n round trips] [-m megabytes]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n < 1) { n = 1; }
+
+    for (int32_t mode = 0; mode < MODE_NR; mode++) {
+        int32_t ret = device ? bench_device(device, mode, n) : bench_pty(mode, n, bulk);
+        if (ret < 0) { return 1; }
+    }
+    return 0;
+}